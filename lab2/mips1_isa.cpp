@@ -37,6 +37,14 @@
 #include  "mips1_isa.H"
 #include  "mips1_isa_init.cpp"
 #include  "mips1_bhv_macros.H"
+#include  <stdio.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <elf.h>
+#include  <algorithm>
+#include  <map>
+#include  <new>
+#include  <string>
 
 
 //If you want debug information for this model, uncomment next line
@@ -123,362 +131,2311 @@ class Instruction
     }
 };
 
-Instruction lastInstruction;
-Instruction lastLastInstruction;
+/**
+ * An entry in the Branch Target Buffer.
+ */
+class BranchTargetBufferEntry
+{
+    enum State {STRONG_TAKEN, WEAK_TAKEN, WEAK_NOT_TAKEN, STRONG_NOT_TAKEN};
+
+    State taken;
+    ac_word target;
+
+  public:
+
+    BranchTargetBufferEntry() {
+      target = 0;
+      taken = WEAK_NOT_TAKEN;
+    }
+
+    /**
+     * Returns the cached branch target.
+     */
+    ac_word getPredictedTarget() {
+      return target;
+    }
+
+    /**
+     * Returns a guess on whether we should branch or not.
+     */
+    bool getPrediction() {
+      return taken == STRONG_TAKEN || taken == WEAK_TAKEN;
+    }
+
+    /**
+     * Updates the guess based on whether the branch was actually taken or not.
+     *
+     * @param branchTaken  whether the branch was taken or not
+     * @param branchTarget the branch's target address
+     */
+    void updatePrediction(bool branchTaken, ac_word branchTarget) {
+      target = branchTarget;
+      switch (taken) {
+        case STRONG_TAKEN:
+          taken = branchTaken ? STRONG_TAKEN : WEAK_TAKEN;
+          break;
+        case WEAK_TAKEN:
+          taken = branchTaken ? STRONG_TAKEN : WEAK_NOT_TAKEN;
+          break;
+        case WEAK_NOT_TAKEN:
+          taken = branchTaken ? WEAK_TAKEN : STRONG_NOT_TAKEN;
+          break;
+        case STRONG_NOT_TAKEN:
+          taken = branchTaken ? WEAK_NOT_TAKEN : STRONG_NOT_TAKEN;
+          break;
+        default:
+          break;
+      }
+    }
+};
+
+/**
+ * A small cache indexed by the lower portion of the address of the branch
+ * instruction that says whether the branch was recently taken or not.
+ * 
+ * It also stores the target address of the branch so that the PC can be updated
+ * right away when prediction says branch should be taken and a new cycle just
+ * for the computation of target address is avoided.
+ */
+class BranchTargetBuffer
+{
+    static const int BYTE_OFFSET = 2;
+
+    uint32_t numIndexBits;
+    uint64_t numPredictions;
+    uint64_t numWrongPredictions;
+    uint64_t numWrongPredictedTargets;
+    std::vector<BranchTargetBufferEntry> predictions;
+
+    uint32_t getIndex(ac_word address) {
+      return (address >> BYTE_OFFSET) & ~(0xFFFFFFFF << numIndexBits);
+    }
+
+  public:
+
+    BranchTargetBuffer(uint32_t numIndexBits)
+      : numIndexBits(numIndexBits)
+      , numPredictions(0)
+      , numWrongPredictions(0)
+      , numWrongPredictedTargets(0)
+      , predictions(1 << numIndexBits)
+    {}
+
+    /**
+     * Updates memory with the latest decision for this branch instruction.
+     * Also, checks whether prediction would've been correct or not.
+     *
+     * @param address      the address of the branch instruction
+     * @param branchTaken  whether the branch was taken or not
+     * @param branchTarget the branch's target address
+     */
+    void update(ac_word address, bool branchTaken, ac_word branchTarget) {
+      BranchTargetBufferEntry& entry = predictions[getIndex(address)];
+      bool prediction = entry.getPrediction();
+      if (prediction != branchTaken) {
+        ++numWrongPredictions;
+      } else if (prediction && entry.getPredictedTarget() != branchTarget) {
+        ++numWrongPredictedTargets;
+      }
+      ++numPredictions;
+
+      entry.updatePrediction(branchTaken, branchTarget);
+    }
+
+    uint64_t getNumPredictions() {
+      return numPredictions;
+    }
+
+    /**
+     * Returns the number of times the "take or not" prediction was wrong.
+     */
+    uint64_t getNumWrongPredictions() {
+      return numWrongPredictions;
+    }
+
+    /**
+     * Returns the number of times the prediction was correctly "take branch",
+     * but the cached target was wrong.
+     */
+    uint64_t getNumWrongPredictedTargets() {
+      return numWrongPredictedTargets;
+    }
+};
+
+/**
+ * Replacement policies of a set-associative cache.
+ */
+enum ReplacementPolicy {LRU, PLRU, FIFO, RANDOM};
+
+/**
+ * What a write hit does to memory: WRITE_BACK only marks the block dirty and
+ * writes it when it is evicted, WRITE_THROUGH writes the word right away.
+ */
+enum WritePolicy {WRITE_BACK, WRITE_THROUGH};
+
+/**
+ * Whether a write miss brings the block into the cache.
+ */
+enum AllocatePolicy {WRITE_ALLOCATE, NO_WRITE_ALLOCATE};
+
+/**
+ * How a cache relates to the caches above it: INCLUSIVE holds every block they
+ * hold and invalidates them on eviction, EXCLUSIVE only holds blocks evicted
+ * from them, NINE (non-inclusive non-exclusive) enforces neither. An
+ * EXCLUSIVE cache gives up whole blocks, so its blocks can't be larger than
+ * those of the caches above it.
+ */
+enum InclusionPolicy {INCLUSIVE, EXCLUSIVE, NINE};
+
+/**
+ * Miss rates of a whole grid of LRU caches, measured in a single pass.
+ *
+ * For each block size and number of sets, every set keeps its blocks in LRU
+ * order as a stack. A block found at depth d hits in every cache of that
+ * geometry with more than d ways, so a histogram of the depths gives the miss
+ * rate for all associativities at once.
+ */
+class StackDistanceProfile
+{
+    static const int BYTE_OFFSET = 2;
+
+    uint32_t minBlockIndexBits, maxBlockIndexBits;
+    uint32_t minIndexBits, maxIndexBits;
+    uint32_t maxWays;
+    uint64_t accesses;
+
+    // One stack per set, most recently used block first, indexed by
+    // set * maxWays + depth
+    struct Geometry {
+      uint32_t numOffsetBits, numIndexBits;
+      std::vector<uint32_t> stacks;
+      std::vector<uint8_t> depths;
+      // hits[d]: accesses found at depth d
+      std::vector<uint64_t> hits;
+    };
+    std::vector<Geometry> geometries;
+
+    void access(Geometry &g, uint32_t address) {
+      uint32_t block = address >> g.numOffsetBits;
+      uint32_t set = block & ((1 << g.numIndexBits) - 1);
+      uint32_t *stack = &g.stacks[set * maxWays];
+      uint32_t depth = g.depths[set];
+
+      uint32_t d = 0;
+      while (d < depth && stack[d] != block) d++;
+      if (d < depth) {
+        ++g.hits[d];
+      } else if (depth < maxWays) {
+        g.depths[set] = ++depth;
+      } else {
+        // Deeper than any simulated way: the last block falls off the stack
+        d = depth - 1;
+      }
+      memmove(stack + 1, stack, d * sizeof(uint32_t));
+      stack[0] = block;
+    }
+
+    Geometry &geometry(uint32_t numBlockIndexBits, uint32_t numIndexBits) {
+      uint32_t numSetCounts = maxIndexBits - minIndexBits + 1;
+      return geometries[(numBlockIndexBits - minBlockIndexBits) * numSetCounts
+                        + numIndexBits - minIndexBits];
+    }
+
+  public:
+
+    /**
+     * @param minBlockIndexBits, maxBlockIndexBits range of log2 of the number
+     *                                              of words per block
+     * @param minIndexBits, maxIndexBits           range of log2 of the number
+     *                                              of sets
+     * @param maxWays                              largest associativity, a
+     *                                              power of two
+     */
+    StackDistanceProfile(uint32_t minBlockIndexBits, uint32_t maxBlockIndexBits,
+                         uint32_t minIndexBits, uint32_t maxIndexBits,
+                         uint32_t maxWays)
+      : minBlockIndexBits(minBlockIndexBits)
+      , maxBlockIndexBits(maxBlockIndexBits)
+      , minIndexBits(minIndexBits)
+      , maxIndexBits(maxIndexBits)
+      , maxWays(maxWays)
+      , accesses(0)
+    {
+      for (uint32_t b = minBlockIndexBits; b <= maxBlockIndexBits; b++) {
+        for (uint32_t i = minIndexBits; i <= maxIndexBits; i++) {
+          Geometry g;
+          g.numOffsetBits = b + BYTE_OFFSET;
+          g.numIndexBits = i;
+          g.stacks.resize((1 << i) * maxWays);
+          g.depths.resize(1 << i);
+          g.hits.resize(maxWays);
+          geometries.push_back(g);
+        }
+      }
+    }
+
+    /**
+     * Records an access to every simulated cache.
+     */
+    void access(uint32_t address) {
+      ++accesses;
+      for (size_t i = 0; i < geometries.size(); i++) {
+        access(geometries[i], address);
+      }
+    }
+
+    /**
+     * Returns the miss rate of an LRU cache, or -1 if it was not simulated.
+     *
+     * @param numIndexBits      log2 of the number of sets
+     * @param numBlockIndexBits log2 of the number of words per block
+     * @param numWays           blocks per set
+     */
+    double getMissRate(uint32_t numIndexBits, uint32_t numBlockIndexBits,
+                       uint32_t numWays) {
+      if (numBlockIndexBits < minBlockIndexBits ||
+          numBlockIndexBits > maxBlockIndexBits ||
+          numIndexBits < minIndexBits || numIndexBits > maxIndexBits ||
+          numWays < 1 || numWays > maxWays) {
+        return -1;
+      }
+      if (accesses == 0) return 0;
+
+      Geometry &g = geometry(numBlockIndexBits, numIndexBits);
+      uint64_t hits = 0;
+      for (uint32_t d = 0; d < numWays; d++) hits += g.hits[d];
+      return (double) (accesses - hits) / accesses;
+    }
+
+    /**
+     * Prints, for each block size, the miss rate by cache size (rows) and
+     * associativity (columns).
+     */
+    void print(const char *name) {
+      char line[256];
+
+      for (uint32_t b = minBlockIndexBits; b <= maxBlockIndexBits; b++) {
+        uint32_t blockBytes = 1 << (b + BYTE_OFFSET);
+        dbg_printf("@@@ %s Miss-Rate, %u-byte blocks @@@\n", name, blockBytes);
+
+        int n = snprintf(line, sizeof(line), "%10s", "size");
+        for (uint32_t ways = 1; ways <= maxWays; ways <<= 1) {
+          n += snprintf(line + n, sizeof(line) - n, " %6u-way", ways);
+        }
+        dbg_printf("@@@ %s @@@\n", line);
+
+        for (uint32_t k = minIndexBits; (1U << k) <= (maxWays << maxIndexBits);
+             k++) {
+          n = snprintf(line, sizeof(line), "%9uB", blockBytes << k);
+          for (uint32_t w = 0; (1U << w) <= maxWays; w++) {
+            // 2^k blocks in 2^w ways
+            if (k < w || k - w < minIndexBits || k - w > maxIndexBits) {
+              n += snprintf(line + n, sizeof(line) - n, " %10s", "-");
+            } else {
+              n += snprintf(line + n, sizeof(line) - n, " %9.2lf%%",
+                            100 * getMissRate(k - w, b, 1 << w));
+            }
+          }
+          dbg_printf("@@@ %s @@@\n", line);
+        }
+      }
+    }
+};
+
+/**
+ * Decides which blocks a cache should bring in ahead of demand. It sees every
+ * access made to the cache it is attached to.
+ */
+class Prefetcher
+{
+  public:
+
+    virtual ~Prefetcher() {}
+
+    /**
+     * Observes an access and appends the addresses to prefetch.
+     *
+     * @param pc         address of the instruction making the access
+     * @param address    the memory address being accessed
+     * @param miss       whether the access missed, or hit a prefetched block
+     *                   for the first time
+     * @param blockBytes block size of the cache
+     * @param prefetches where the addresses to prefetch are appended
+     */
+    virtual void access(ac_word pc, ac_word address, bool miss,
+                        uint32_t blockBytes,
+                        std::vector<ac_word>& prefetches) = 0;
+};
+
+/**
+ * Prefetches the next blocks after every miss.
+ */
+class NextLinePrefetcher : public Prefetcher
+{
+    uint32_t degree;
+
+  public:
+
+    /**
+     * @param degree number of blocks to prefetch after a miss
+     */
+    NextLinePrefetcher(uint32_t degree) : degree(degree) {}
+
+    void access(ac_word pc, ac_word address, bool miss, uint32_t blockBytes,
+                std::vector<ac_word>& prefetches) {
+      if (!miss) return;
+      ac_word block = address & ~(blockBytes - 1);
+      for (uint32_t i = 1; i <= degree; i++) {
+        prefetches.push_back(block + i * blockBytes);
+      }
+    }
+};
+
+/**
+ * Learns the stride of each load or store in a table indexed by its PC, and
+ * prefetches ahead once the same stride was seen twice in a row.
+ */
+class StridePrefetcher : public Prefetcher
+{
+    struct Entry {
+      ac_word pc;
+      ac_word lastAddress;
+      int32_t stride;
+      // Saturates at 3, prefetches from 2
+      uint8_t confidence;
+    };
+
+    uint32_t numIndexBits, degree;
+    std::vector<Entry> entries;
+
+  public:
+
+    /**
+     * @param numIndexBits log2 of the number of table entries
+     * @param degree       strides to prefetch ahead
+     */
+    StridePrefetcher(uint32_t numIndexBits, uint32_t degree)
+      : numIndexBits(numIndexBits)
+      , degree(degree)
+      , entries(1 << numIndexBits)
+    {
+      for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].pc = 0xFFFFFFFF;
+      }
+    }
+
+    void access(ac_word pc, ac_word address, bool miss, uint32_t blockBytes,
+                std::vector<ac_word>& prefetches) {
+      Entry &entry = entries[(pc >> 2) & ~(0xFFFFFFFF << numIndexBits)];
+
+      if (entry.pc != pc) {
+        entry.pc = pc;
+        entry.lastAddress = address;
+        entry.stride = 0;
+        entry.confidence = 0;
+        return;
+      }
+
+      int32_t stride = address - entry.lastAddress;
+      entry.lastAddress = address;
+      if (stride == 0) return;
+      if (stride == entry.stride) {
+        if (entry.confidence < 3) ++entry.confidence;
+      } else {
+        if (entry.confidence > 0) --entry.confidence;
+        if (entry.confidence == 0) entry.stride = stride;
+        return;
+      }
+
+      if (entry.confidence < 2) return;
+      for (uint32_t i = 1; i <= degree; i++) {
+        prefetches.push_back(address + i * stride);
+      }
+    }
+};
+
+/**
+ * Stream buffers that fill into the cache: a miss that does not continue a
+ * stream starts a new one, replacing the least recently used, and a miss or
+ * prefetched hit on the head of a stream keeps it depth blocks ahead.
+ */
+class StreamPrefetcher : public Prefetcher
+{
+    struct Stream {
+      // Next block the stream expects to be used, and the one after the last
+      // block prefetched
+      ac_word head, tail;
+      uint64_t lastUse;
+      bool valid;
+    };
+
+    uint32_t depth;
+    std::vector<Stream> streams;
+    uint64_t clock;
+
+  public:
+
+    /**
+     * @param numStreams number of streams followed at once
+     * @param depth      blocks kept ahead of each stream
+     */
+    StreamPrefetcher(uint32_t numStreams, uint32_t depth)
+      : depth(depth)
+      , streams(numStreams)
+      , clock(0)
+    {
+      for (size_t i = 0; i < streams.size(); i++) {
+        streams[i].valid = false;
+        streams[i].lastUse = 0;
+      }
+    }
+
+    void access(ac_word pc, ac_word address, bool miss, uint32_t blockBytes,
+                std::vector<ac_word>& prefetches) {
+      if (!miss) return;
+      ++clock;
+
+      ac_word block = address & ~(blockBytes - 1);
+      Stream *stream = NULL;
+      for (size_t i = 0; i < streams.size(); i++) {
+        Stream &s = streams[i];
+        if (s.valid && block >= s.head && block < s.tail) {
+          stream = &s;
+          break;
+        }
+      }
+
+      if (stream == NULL) {
+        stream = &streams[0];
+        for (size_t i = 1; i < streams.size(); i++) {
+          if (!stream->valid) break;
+          if (!streams[i].valid || streams[i].lastUse < stream->lastUse) {
+            stream = &streams[i];
+          }
+        }
+        stream->valid = true;
+        stream->tail = block + blockBytes;
+      }
+
+      stream->head = block + blockBytes;
+      stream->lastUse = clock;
+      while (stream->tail < stream->head + depth * blockBytes) {
+        prefetches.push_back(stream->tail);
+        stream->tail += blockBytes;
+      }
+    }
+};
+
+/**
+ * Functions and objects of the guest program, read from its ELF symbol table,
+ * so that addresses can be reported by name.
+ */
+class SymbolTable
+{
+    struct Symbol {
+      ac_word address;
+      uint32_t size;
+      std::string name;
+
+      bool operator<(const Symbol& other) const {
+        return address < other.address;
+      }
+    };
+
+    // Sorted by address
+    std::vector<Symbol> symbols;
+
+  public:
+
+    /**
+     * Reads the sized STT_FUNC and STT_OBJECT symbols of a 32-bit ELF file.
+     *
+     * @param path the guest program
+     * @returns whether it had a symbol table
+     */
+    bool load(const char *path) {
+      FILE *file = fopen(path, "rb");
+      if (file == NULL) return false;
+      std::vector<unsigned char> image;
+      int c;
+      while ((c = fgetc(file)) != EOF) image.push_back(c);
+      fclose(file);
+
+      if (image.size() < sizeof(Elf32_Ehdr) ||
+          memcmp(&image[0], ELFMAG, SELFMAG) != 0 ||
+          image[EI_CLASS] != ELFCLASS32) {
+        return false;
+      }
+      // The guest is big-endian, the host most likely not
+      uint16_t probe = 1;
+      bool hostLittleEndian = *(unsigned char *) &probe == 1;
+      bool swap = (image[EI_DATA] == ELFDATA2LSB) != hostLittleEndian;
+
+      const Elf32_Ehdr *header = (const Elf32_Ehdr *) &image[0];
+      uint32_t sectionsOffset = word(header->e_shoff, swap);
+      uint32_t numSections = half(header->e_shnum, swap);
+      if (half(header->e_shentsize, swap) != sizeof(Elf32_Shdr) ||
+          sectionsOffset + (uint64_t) numSections * sizeof(Elf32_Shdr) >
+          image.size()) {
+        return false;
+      }
+      const Elf32_Shdr *sections = (const Elf32_Shdr *) &image[sectionsOffset];
+
+      for (uint32_t i = 0; i < numSections; i++) {
+        if (word(sections[i].sh_type, swap) != SHT_SYMTAB) continue;
+        uint32_t link = word(sections[i].sh_link, swap);
+        if (link >= numSections) return false;
+
+        uint32_t offset = word(sections[i].sh_offset, swap);
+        uint32_t size = word(sections[i].sh_size, swap);
+        uint32_t namesOffset = word(sections[link].sh_offset, swap);
+        uint32_t namesSize = word(sections[link].sh_size, swap);
+        if ((uint64_t) offset + size > image.size() ||
+            (uint64_t) namesOffset + namesSize > image.size()) {
+          return false;
+        }
+
+        const Elf32_Sym *entries = (const Elf32_Sym *) &image[offset];
+        const char *names = (const char *) &image[namesOffset];
+        for (uint32_t j = 0; j < size / sizeof(Elf32_Sym); j++) {
+          int type = ELF32_ST_TYPE(entries[j].st_info);
+          uint32_t name = word(entries[j].st_name, swap);
+          Symbol symbol;
+          symbol.address = word(entries[j].st_value, swap);
+          symbol.size = word(entries[j].st_size, swap);
+          if ((type != STT_FUNC && type != STT_OBJECT) || symbol.size == 0 ||
+              name >= namesSize) {
+            continue;
+          }
+          symbol.name.assign(names + name, strnlen(names + name,
+                                                   namesSize - name));
+          symbols.push_back(symbol);
+        }
+        std::sort(symbols.begin(), symbols.end());
+        return true;
+      }
+      return false;
+    }
+
+    /**
+     * Returns the name of the symbol containing an address, or NULL.
+     *
+     * @param address the address to look up
+     * @param offset  set to how far into the symbol the address is
+     */
+    const char *find(ac_word address, uint32_t& offset) const {
+      Symbol key;
+      key.address = address;
+      std::vector<Symbol>::const_iterator it =
+        std::upper_bound(symbols.begin(), symbols.end(), key);
+      if (it == symbols.begin()) return NULL;
+      --it;
+      if (address - it->address >= it->size) return NULL;
+      offset = address - it->address;
+      return it->name.c_str();
+    }
+
+  private:
+
+    static uint32_t word(uint32_t value, bool swap) {
+      return swap ? __builtin_bswap32(value) : value;
+    }
+
+    static uint16_t half(uint16_t value, bool swap) {
+      return swap ? (uint16_t) (value << 8 | value >> 8) : value;
+    }
+};
+
+/**
+ * Misses of a cache counted by the instruction that caused them, by the
+ * address they were for, reported by the data structure holding it, and by
+ * the block of that address. Only misses are recorded, so hits cost nothing.
+ */
+class MissAttribution
+{
+    uint64_t misses;
+    std::map<ac_word, uint64_t> pcMisses;
+    // Symbols are looked up by the address itself: a block may start before
+    // the data structure it was missed for
+    std::map<ac_word, uint64_t> addressMisses;
+    std::map<ac_word, uint64_t> blockMisses;
+
+    /**
+     * Prints the keys with the most misses, largest first.
+     */
+    void printTop(const std::map<ac_word, uint64_t>& counts,
+                  const SymbolTable& symbols, uint32_t top) {
+      std::vector<std::pair<uint64_t, ac_word> > sorted;
+      for (std::map<ac_word, uint64_t>::const_iterator it = counts.begin();
+           it != counts.end(); ++it) {
+        sorted.push_back(std::make_pair(it->second, it->first));
+      }
+      if (top > sorted.size()) top = sorted.size();
+      std::partial_sort(sorted.begin(), sorted.begin() + top, sorted.end(),
+                        std::greater<std::pair<uint64_t, ac_word> >());
+
+      for (uint32_t i = 0; i < top; i++) {
+        uint32_t offset;
+        const char *name = symbols.find(sorted[i].second, offset);
+        char location[64];
+        if (name != NULL) {
+          snprintf(location, sizeof(location), "%s+0x%x", name, offset);
+        } else {
+          snprintf(location, sizeof(location), "?");
+        }
+        dbg_printf("@@@   0x%08x %-32s %10llu %6.2lf%% @@@\n",
+                   sorted[i].second, location, sorted[i].first,
+                   100.0 * sorted[i].first / misses);
+      }
+    }
+
+  public:
+
+    MissAttribution()
+      : misses(0)
+    {}
+
+    /**
+     * Records a miss.
+     *
+     * @param pc      address of the instruction that missed
+     * @param address address it missed on
+     * @param block   address of the block holding it
+     */
+    void recordMiss(ac_word pc, ac_word address, ac_word block) {
+      ++misses;
+      ++pcMisses[pc];
+      ++addressMisses[address];
+      ++blockMisses[block];
+    }
+
+    /**
+     * Prints the instructions and the data structures with the most misses,
+     * and the cache lines of the latter that missed the most.
+     *
+     * @param name    name of the cache
+     * @param symbols symbols of the guest program, possibly none
+     * @param top     number of entries in each list
+     */
+    void print(const char *name, const SymbolTable& symbols, uint32_t top) {
+      if (misses == 0) return;
+
+      dbg_printf("@@@ %s Misses by Instruction (%llu misses, %u PCs) @@@\n",
+                 name, misses, (uint32_t) pcMisses.size());
+      printTop(pcMisses, symbols, top);
+
+      std::map<std::string, uint64_t> symbolMisses;
+      for (std::map<ac_word, uint64_t>::const_iterator it =
+             addressMisses.begin(); it != addressMisses.end(); ++it) {
+        uint32_t offset;
+        const char *symbol = symbols.find(it->first, offset);
+        symbolMisses[symbol != NULL ? symbol : "(no symbol)"] += it->second;
+      }
+      std::vector<std::pair<uint64_t, std::string> > sorted;
+      for (std::map<std::string, uint64_t>::const_iterator it =
+             symbolMisses.begin(); it != symbolMisses.end(); ++it) {
+        sorted.push_back(std::make_pair(it->second, it->first));
+      }
+      uint32_t count = std::min<size_t>(top, sorted.size());
+      std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(),
+                        std::greater<std::pair<uint64_t, std::string> >());
+
+      dbg_printf("@@@ %s Misses by Data Structure @@@\n", name);
+      for (uint32_t i = 0; i < count; i++) {
+        dbg_printf("@@@   %-43s %10llu %6.2lf%% @@@\n",
+                   sorted[i].second.c_str(), sorted[i].first,
+                   100.0 * sorted[i].first / misses);
+      }
+
+      dbg_printf("@@@ %s Misses by Block (%u blocks) @@@\n", name,
+                 (uint32_t) blockMisses.size());
+      printTop(blockMisses, symbols, top);
+    }
+};
+
+// Latency, in cycles, of a block fetch from main memory
+#define MEMORY_LATENCY 100
+
+/**
+ * A set-associative cache with variable number of word-sized blocks, without
+ * the actual data.
+ *
+ * Blocks are kept as a structure of arrays: the tags of a set are contiguous
+ * and its valid bits are packed in one word, so a lookup touches one or two
+ * host cache lines. Replacement state lives in separate arrays that are only
+ * touched on hits and fills.
+ */
+class Cache
+{
+    static const int BYTE_OFFSET = 2;
+    static const uint32_t MAX_WAYS = 32;
+
+    uint64_t readHits, readMisses;
+    uint64_t writeHits, writeMisses;
+    // Traffic to the next level: blocks filled and written back, words
+    // written through
+    uint64_t fills, writebacks, writeThroughs;
+    uint64_t backInvalidations;
+    // Prefetches issued, first used by a demand access, and used before the
+    // fetch could have completed
+    uint64_t prefetches, usefulPrefetches, latePrefetches;
+    // Accesses made to this cache, the time base of prefetch timeliness
+    uint64_t clock;
+    uint32_t numIndexBits, numTagBits, numOffsetBits, blockBytes;
+
+    uint32_t numSets, numWays;
+    ReplacementPolicy policy;
+    WritePolicy writePolicy;
+    AllocatePolicy allocatePolicy;
+
+    // The next level, or NULL for main memory, and the levels above
+    Cache *next;
+    std::vector<Cache *> uppers;
+    InclusionPolicy inclusion;
+    uint32_t hitTime;
+    // Only used by the last level
+    uint32_t memoryLatency;
+    // Also sees every read and write made to this cache, or NULL
+    StackDistanceProfile *profile;
+    Prefetcher *prefetcher;
+    std::vector<ac_word> prefetchQueue;
+    // Told about every miss, or NULL
+    MissAttribution *attribution;
+
+    // Indexed by set * numWays + way
+    std::vector<uint32_t> tags;
+    // LRU and FIFO: 0 for the most recently used (or filled) way of the set
+    std::vector<uint8_t> ranks;
+    // Indexed by set, one bit per way
+    std::vector<uint32_t> validBits;
+    std::vector<uint32_t> dirtyBits;
+    // Blocks brought by a prefetch and not used yet
+    std::vector<uint32_t> prefetchedBits;
+    // PLRU: numWays - 1 tree nodes per set, each pointing to the half to evict
+    std::vector<uint32_t> treeBits;
+    uint32_t randomState;
+    // Indexed by set * numWays + way, clock when the block was prefetched
+    std::vector<uint64_t> prefetchTimes;
+
+    // Fully associative victim cache holding the last blocks evicted from this
+    // one, by block address; empty when there is none
+    std::vector<ac_word> victimBlocks;
+    std::vector<uint64_t> victimUses;
+    uint32_t victimValid, victimDirty;
+    uint64_t victimHits;
+
+    // Miss status holding registers: the block each one fetches and the MSHR
+    // clock when the fetch completes; empty when misses aren't tracked
+    std::vector<ac_word> mshrBlocks;
+    std::vector<uint64_t> mshrReady;
+    // Accesses made to this cache plus the cycles they waited for an MSHR,
+    // kept apart from clock so that stalls don't change prefetch timeliness
+    uint64_t mshrClock;
+    // Misses to a block already being fetched, and misses that found every
+    // MSHR busy along with the cycles they waited
+    uint64_t secondaryMisses, mshrStalls, mshrStallCycles;
+    // Sum over primary misses of the MSHRs busy when they arrived
+    uint64_t outstandingMisses, maxOutstandingMisses;
+
+    /**
+     * Looks for a tag in a set.
+     *
+     * @returns the way holding the tag, or -1 if it is not in the set
+     */
+    int find(uint32_t set, uint32_t tag) {
+      const uint32_t *setTags = &tags[set * numWays];
+      uint32_t valid = validBits[set];
+      for (uint32_t way = 0; way < numWays; way++) {
+        if ((valid >> way & 1) && setTags[way] == tag) return way;
+      }
+      return -1;
+    }
+
+    /**
+     * Makes a way the most recently used one of its set.
+     */
+    void promote(uint32_t set, uint32_t way) {
+      uint8_t *setRanks = &ranks[set * numWays];
+      uint8_t rank = setRanks[way];
+      for (uint32_t w = 0; w < numWays; w++) {
+        if (setRanks[w] < rank) ++setRanks[w];
+      }
+      setRanks[way] = 0;
+    }
+
+    /**
+     * Updates the replacement state after a way was used.
+     *
+     * @param filled whether the way was just filled, rather than hit
+     */
+    void touch(uint32_t set, uint32_t way, bool filled) {
+      switch (policy) {
+        case LRU:
+          promote(set, way);
+          break;
+        case FIFO:
+          // Only the insertion order counts
+          if (filled) promote(set, way);
+          break;
+        case PLRU: {
+          // Walk from the root, pointing every node away from this way
+          uint32_t node = 1;
+          for (uint32_t half = numWays >> 1; half > 0; half >>= 1) {
+            bool right = way & half;
+            if (right) {
+              treeBits[set] &= ~(1U << node);
+            } else {
+              treeBits[set] |= 1U << node;
+            }
+            node = 2 * node + right;
+          }
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    /**
+     * Picks the way to be replaced in a set, preferring invalid ways.
+     */
+    uint32_t victim(uint32_t set) {
+      uint32_t valid = validBits[set];
+      for (uint32_t way = 0; way < numWays; way++) {
+        if (!(valid >> way & 1)) return way;
+      }
+
+      switch (policy) {
+        case PLRU: {
+          uint32_t node = 1, way = 0;
+          for (uint32_t half = numWays >> 1; half > 0; half >>= 1) {
+            bool right = treeBits[set] >> node & 1;
+            if (right) way |= half;
+            node = 2 * node + right;
+          }
+          return way;
+        }
+        case RANDOM:
+          // xorshift32
+          randomState ^= randomState << 13;
+          randomState ^= randomState >> 17;
+          randomState ^= randomState << 5;
+          return randomState % numWays;
+        default: {
+          const uint8_t *setRanks = &ranks[set * numWays];
+          for (uint32_t way = 0; way < numWays; way++) {
+            if (setRanks[way] == numWays - 1) return way;
+          }
+          return 0;
+        }
+      }
+    }
+
+    /**
+     * Splits an address into the set it maps to and its tag.
+     */
+    void decode(ac_word address, uint32_t& set, uint32_t& tag) {
+      address >>= numOffsetBits;
+      tag = address >> numIndexBits;
+      set = address & ~(0xFFFFFFFF << numIndexBits);
+    }
+
+    /**
+     * Returns the address of the first byte of the block held by a way.
+     */
+    ac_word blockAddress(uint32_t set, uint32_t way) {
+      return ((tags[set * numWays + way] << numIndexBits) | set)
+             << numOffsetBits;
+    }
+
+    /**
+     * Returns the step that walks a block of this cache in blocks of the next
+     * level, which may be smaller.
+     */
+    uint32_t nextBlockStep() {
+      return next->blockBytes < blockBytes ? next->blockBytes : blockBytes;
+    }
+
+    /**
+     * Marks a way as invalid.
+     */
+    void drop(uint32_t set, uint32_t way) {
+      validBits[set] &= ~(1U << way);
+      dirtyBits[set] &= ~(1U << way);
+      prefetchedBits[set] &= ~(1U << way);
+    }
+
+    /**
+     * Brings a block from the next level. An exclusive next level gives the
+     * block up, so it may come back dirty.
+     *
+     * @returns whether the block arrives dirty
+     */
+    bool fetch(ac_word address) {
+      bool dirty = false;
+
+      ++fills;
+      if (next == NULL) return false;
+
+      ac_word first = address & ~(blockBytes - 1);
+      for (uint32_t offset = 0; offset < blockBytes; offset += nextBlockStep()) {
+        if (next->inclusion == EXCLUSIVE) {
+          dirty |= next->extract(first + offset);
+        } else {
+          next->read(first + offset);
+        }
+      }
+      return dirty;
+    }
+
+    /**
+     * Sends a word being written through to the next level that keeps it.
+     */
+    void writeThrough(ac_word address) {
+      ++writeThroughs;
+      Cache *level = next;
+      while (level != NULL && level->inclusion == EXCLUSIVE) {
+        level = level->next;
+      }
+      if (level != NULL) level->write(address);
+    }
+
+    /**
+     * Removes a block from this cache, writing it back or handing it to an
+     * exclusive next level. An inclusive cache first invalidates the copies
+     * above, whose dirty data is then written back from here.
+     */
+    void evict(uint32_t set, uint32_t way) {
+      ac_word address = blockAddress(set, way);
+      bool dirty = dirtyBits[set] >> way & 1;
+
+      drop(set, way);
+
+      if (inclusion == INCLUSIVE) {
+        for (size_t i = 0; i < uppers.size(); i++) {
+          dirty |= uppers[i]->invalidate(address, blockBytes);
+        }
+      }
+
+      if (victimBlocks.empty()) {
+        writeBack(address, dirty);
+      } else {
+        stashVictim(address, dirty);
+      }
+    }
+
+    /**
+     * Sends a block leaving this cache to the next level.
+     */
+    void writeBack(ac_word address, bool dirty) {
+      if (dirty) ++writebacks;
+      if (next == NULL) return;
+
+      for (uint32_t offset = 0; offset < blockBytes; offset += nextBlockStep()) {
+        if (next->inclusion == EXCLUSIVE) {
+          next->insert(address + offset, dirty);
+        } else if (dirty) {
+          next->write(address + offset);
+        }
+      }
+    }
+
+    /**
+     * Keeps an evicted block in the victim cache, sending the least recently
+     * used entry on to the next level if it is full.
+     */
+    void stashVictim(ac_word address, bool dirty) {
+      uint32_t entry = 0;
+      for (uint32_t i = 0; i < victimBlocks.size(); i++) {
+        if (!(victimValid >> i & 1)) {
+          entry = i;
+          break;
+        }
+        if (victimUses[i] < victimUses[entry]) entry = i;
+      }
+
+      if (victimValid >> entry & 1) {
+        writeBack(victimBlocks[entry], victimDirty >> entry & 1);
+      }
+      victimBlocks[entry] = address;
+      victimUses[entry] = clock;
+      victimValid |= 1U << entry;
+      victimDirty = (victimDirty & ~(1U << entry)) | (uint32_t) dirty << entry;
+    }
+
+    /**
+     * Removes a block from the victim cache.
+     *
+     * @param dirty set to whether the block was dirty
+     * @returns whether the block was there
+     */
+    bool takeVictim(ac_word address, bool& dirty) {
+      ac_word block = address & ~(blockBytes - 1);
+      for (uint32_t i = 0; i < victimBlocks.size(); i++) {
+        if ((victimValid >> i & 1) && victimBlocks[i] == block) {
+          dirty = victimDirty >> i & 1;
+          victimValid &= ~(1U << i);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * Tells whether a block is still being fetched by an earlier miss.
+     */
+    bool isPending(ac_word address) {
+      ac_word block = address & ~(blockBytes - 1);
+      for (uint32_t i = 0; i < mshrBlocks.size(); i++) {
+        if (mshrReady[i] > mshrClock && mshrBlocks[i] == block) return true;
+      }
+      return false;
+    }
+
+    /**
+     * Takes an MSHR for a primary miss. If they are all busy the access waits,
+     * and time moves on, until the first one frees up.
+     */
+    void allocateMSHR(ac_word address) {
+      uint32_t entry = 0, busy = 0;
+      for (uint32_t i = 0; i < mshrBlocks.size(); i++) {
+        if (mshrReady[i] > mshrClock) ++busy;
+        if (mshrReady[i] < mshrReady[entry]) entry = i;
+      }
+
+      outstandingMisses += busy;
+      if (busy > maxOutstandingMisses) maxOutstandingMisses = busy;
+      if (mshrReady[entry] > mshrClock) {
+        ++mshrStalls;
+        mshrStallCycles += mshrReady[entry] - mshrClock;
+        mshrClock = mshrReady[entry];
+      }
+      mshrBlocks[entry] = address & ~(blockBytes - 1);
+      mshrReady[entry] = mshrClock + (uint64_t) getMissPenalty();
+    }
+
+    /**
+     * Places a block in a set, evicting the victim if needed.
+     *
+     * @returns the way the block went to
+     */
+    uint32_t fill(uint32_t set, uint32_t tag) {
+      uint32_t way = victim(set);
+      if (validBits[set] >> way & 1) evict(set, way);
+      tags[set * numWays + way] = tag;
+      validBits[set] |= 1U << way;
+      touch(set, way, true);
+      return way;
+    }
+
+    /**
+     * Simulates a cache access (read or write) and checks whether it would've
+     * been a hit or not.
+     *
+     * @param address     the memory address being accessed
+     * @param pc          address of the instruction making the access
+     * @param hitCounter  pointer to the hit counter
+     * @param missCounter pointer to the miss counter
+     * @param isWrite     whether the access is a write
+     * @returns whether it missed or was the first use of a prefetched block
+     */
+    bool access(
+        ac_word address,
+        ac_word pc,
+        uint64_t& hitCounter,
+        uint64_t& missCounter,
+        bool isWrite) {
+      uint32_t tag, set;
+      bool trigger = false;
+      decode(address, set, tag);
+
+      ++clock;
+      ++mshrClock;
+      int way = find(set, tag);
+      if (way >= 0) {
+        ++hitCounter;
+        touch(set, way, false);
+        if (!mshrBlocks.empty() && isPending(address)) ++secondaryMisses;
+        if (prefetchedBits[set] >> way & 1) {
+          prefetchedBits[set] &= ~(1U << way);
+          ++usefulPrefetches;
+          if (clock - prefetchTimes[set * numWays + way] < getMissPenalty()) {
+            ++latePrefetches;
+          }
+          trigger = true;
+        }
+      } else {
+        ++missCounter;
+        trigger = true;
+        if (attribution != NULL) {
+          attribution->recordMiss(pc, address, address & ~(blockBytes - 1));
+        }
+
+        bool dirty;
+        if (!victimBlocks.empty() && takeVictim(address, dirty)) {
+          // Swapped with the block it replaces
+          ++victimHits;
+          if (!mshrBlocks.empty() && isPending(address)) ++secondaryMisses;
+          way = fill(set, tag);
+          if (dirty) dirtyBits[set] |= 1U << way;
+        } else {
+          if (!mshrBlocks.empty()) allocateMSHR(address);
+          if (isWrite && allocatePolicy == NO_WRITE_ALLOCATE) {
+            // The word goes straight to the next level
+            writeThrough(address);
+            return trigger;
+          }
+
+          dirty = fetch(address);
+          way = fill(set, tag);
+          if (dirty) dirtyBits[set] |= 1U << way;
+        }
+      }
+
+      if (isWrite) {
+        if (writePolicy == WRITE_BACK) {
+          dirtyBits[set] |= 1U << way;
+        } else {
+          writeThrough(address);
+        }
+      }
+      return trigger;
+    }
+
+    /**
+     * Brings a block in ahead of demand, unless it is already here.
+     */
+    void prefetch(ac_word address) {
+      uint32_t tag, set;
+      decode(address, set, tag);
+      if (find(set, tag) >= 0) return;
+      for (uint32_t i = 0; i < victimBlocks.size(); i++) {
+        if ((victimValid >> i & 1) &&
+            victimBlocks[i] == (address & ~(blockBytes - 1))) {
+          return;
+        }
+      }
+
+      ++prefetches;
+      bool dirty = fetch(address);
+      uint32_t way = fill(set, tag);
+      if (dirty) dirtyBits[set] |= 1U << way;
+      prefetchedBits[set] |= 1U << way;
+      prefetchTimes[set * numWays + way] = clock;
+    }
+
+    /**
+     * Lets the prefetcher observe an access and issues what it asks for.
+     */
+    void runPrefetcher(ac_word pc, ac_word address, bool trigger) {
+      prefetchQueue.clear();
+      prefetcher->access(pc, address, trigger, blockBytes, prefetchQueue);
+      for (size_t i = 0; i < prefetchQueue.size(); i++) {
+        prefetch(prefetchQueue[i]);
+      }
+    }
+
+    /**
+     * Returns the expected number of cycles a miss takes to be served.
+     */
+    double getMissPenalty() {
+      return next != NULL ? next->getAMAT() : memoryLatency;
+    }
+
+    /**
+     * Serves a miss from the level above in an exclusive cache: the block
+     * moves up and leaves this cache. On a miss here it is fetched from the
+     * next level without being kept. Hits, misses, victim hits and MSHRs are
+     * counted as in access().
+     *
+     * @returns whether the block was dirty
+     */
+    bool extract(ac_word address) {
+      uint32_t tag, set;
+      decode(address, set, tag);
+
+      ++clock;
+      ++mshrClock;
+      int way = find(set, tag);
+      if (way < 0) {
+        ++readMisses;
+        bool dirty;
+        if (!victimBlocks.empty() && takeVictim(address, dirty)) {
+          ++victimHits;
+          if (!mshrBlocks.empty() && isPending(address)) ++secondaryMisses;
+          return dirty;
+        }
+        if (!mshrBlocks.empty()) allocateMSHR(address);
+        return fetch(address);
+      }
+
+      ++readHits;
+      if (!mshrBlocks.empty() && isPending(address)) ++secondaryMisses;
+      bool dirty = dirtyBits[set] >> way & 1;
+      drop(set, way);
+      return dirty;
+    }
+
+    /**
+     * Takes a block evicted from the level above in an exclusive cache.
+     */
+    void insert(ac_word address, bool dirty) {
+      uint32_t tag, set;
+      decode(address, set, tag);
+
+      int way = find(set, tag);
+      if (way < 0) way = fill(set, tag);
+      if (dirty) dirtyBits[set] |= 1U << way;
+    }
+
+    /**
+     * Drops the blocks overlapping a byte range, along with their copies in
+     * the levels above when this cache is inclusive.
+     *
+     * @returns whether any of them was dirty
+     */
+    bool invalidate(ac_word address, uint32_t bytes) {
+      bool dirty = false;
+      ac_word first = address & ~(blockBytes - 1);
+
+      for (ac_word block = first; block - first < bytes; block += blockBytes) {
+        uint32_t tag, set;
+        decode(block, set, tag);
+        int way = find(set, tag);
+        bool wasDirty;
+        if (way >= 0) {
+          ++backInvalidations;
+          dirty |= dirtyBits[set] >> way & 1;
+          drop(set, way);
+        } else if (!victimBlocks.empty() && takeVictim(block, wasDirty)) {
+          ++backInvalidations;
+          dirty |= wasDirty;
+        }
+      }
+
+      if (inclusion == INCLUSIVE) {
+        for (size_t i = 0; i < uppers.size(); i++) {
+          dirty |= uppers[i]->invalidate(address, bytes);
+        }
+      }
+      return dirty;
+    }
+
+  public:
+
+    /**
+     * @param numIndexBits      log2 of the number of sets
+     * @param numBlockIndexBits log2 of the number of words per block
+     * @param numWays           blocks per set, up to 32
+     * @param policy            how to pick the block to be replaced
+     * @param writePolicy       when writes reach memory
+     * @param allocatePolicy    whether write misses fill a block
+     */
+    Cache(uint32_t numIndexBits, uint32_t numBlockIndexBits,
+          uint32_t numWays = 1, ReplacementPolicy policy = LRU,
+          WritePolicy writePolicy = WRITE_BACK,
+          AllocatePolicy allocatePolicy = WRITE_ALLOCATE)
+      : readHits(0)
+      , readMisses(0)
+      , writeHits(0)
+      , writeMisses(0)
+      , fills(0)
+      , writebacks(0)
+      , writeThroughs(0)
+      , backInvalidations(0)
+      , prefetches(0)
+      , usefulPrefetches(0)
+      , latePrefetches(0)
+      , clock(0)
+      , numIndexBits(numIndexBits)
+      , numTagBits(AC_WORDSIZE - numIndexBits - numBlockIndexBits - BYTE_OFFSET)
+      , numOffsetBits(numBlockIndexBits + BYTE_OFFSET)
+      , blockBytes(1 << (numBlockIndexBits + BYTE_OFFSET))
+      , numSets(1 << numIndexBits)
+      , numWays(numWays < 1 ? 1 : numWays > MAX_WAYS ? MAX_WAYS : numWays)
+      , policy(policy)
+      , writePolicy(writePolicy)
+      , allocatePolicy(allocatePolicy)
+      , next(NULL)
+      , inclusion(NINE)
+      , hitTime(1)
+      , memoryLatency(MEMORY_LATENCY)
+      , profile(NULL)
+      , prefetcher(NULL)
+      , attribution(NULL)
+      , randomState(0x9E3779B9)
+      , victimValid(0)
+      , victimDirty(0)
+      , victimHits(0)
+      , mshrClock(0)
+      , secondaryMisses(0)
+      , mshrStalls(0)
+      , mshrStallCycles(0)
+      , outstandingMisses(0)
+      , maxOutstandingMisses(0)
+    {
+      // The PLRU tree needs a power of two number of ways
+      if (policy == PLRU && (this->numWays & (this->numWays - 1))) {
+        this->policy = LRU;
+      }
+
+      tags.assign(numSets * this->numWays, 0);
+      validBits.assign(numSets, 0);
+      dirtyBits.assign(numSets, 0);
+      prefetchedBits.assign(numSets, 0);
+      prefetchTimes.assign(numSets * this->numWays, 0);
+      treeBits.assign(numSets, 0);
+      ranks.resize(numSets * this->numWays);
+      for (uint32_t i = 0; i < ranks.size(); i++) {
+        ranks[i] = i % this->numWays;
+      }
+    }
+
+    /**
+     * Makes misses of this cache go to another one instead of main memory.
+     */
+    void setNextLevel(Cache *level) {
+      if (next == level) return;
+      next = level;
+      level->uppers.push_back(this);
+    }
+
+    /**
+     * Sets how this cache relates to the caches above it.
+     */
+    void setInclusion(InclusionPolicy policy) {
+      inclusion = policy;
+    }
+
+    /**
+     * Sets the number of cycles a hit takes.
+     */
+    void setHitTime(uint32_t cycles) {
+      hitTime = cycles;
+    }
+
+    /**
+     * Sets the number of cycles a block takes to come from main memory, when
+     * this is the last level.
+     */
+    void setMemoryLatency(uint32_t cycles) {
+      memoryLatency = cycles;
+    }
+
+    /**
+     * Puts a fully associative victim cache behind this one. Blocks evicted
+     * from here go to it, and a miss that finds its block there swaps the two
+     * without going to the next level.
+     *
+     * @param entries number of blocks it holds, up to 32, or 0 for none
+     */
+    void setVictimCache(uint32_t entries) {
+      if (entries > MAX_WAYS) entries = MAX_WAYS;
+      victimBlocks.assign(entries, 0);
+      victimUses.assign(entries, 0);
+      victimValid = 0;
+      victimDirty = 0;
+    }
+
+    /**
+     * Tracks the misses being served with a number of MSHRs, each busy for
+     * the miss penalty, taking one access to this cache per cycle.
+     *
+     * @param count number of MSHRs, or 0 to not track misses
+     */
+    void setMSHRs(uint32_t count) {
+      mshrBlocks.assign(count, 0);
+      mshrReady.assign(count, 0);
+    }
+
+    /**
+     * Feeds the accesses made to this cache to a profile as well.
+     */
+    void setProfile(StackDistanceProfile *profile) {
+      this->profile = profile;
+    }
+
+    /**
+     * Attaches a prefetcher to this cache.
+     */
+    void setPrefetcher(Prefetcher *prefetcher) {
+      this->prefetcher = prefetcher;
+    }
+
+    /**
+     * Reports every miss of this cache to an attribution.
+     */
+    void setAttribution(MissAttribution *attribution) {
+      this->attribution = attribution;
+    }
+
+    /**
+     * Simulates a cache read and checks whether it would've been a hit or not.
+     *
+     * @param address the memory address being read
+     * @param pc      address of the instruction reading it
+     */
+    void read(ac_word address, ac_word pc = 0) {
+      if (profile != NULL) profile->access(address);
+      bool trigger = access(address, pc, readHits, readMisses, false);
+      if (prefetcher != NULL) runPrefetcher(pc, address, trigger);
+    }
+
+    /**
+     * Simulates a cache write and checks whether it would've been a hit or not.
+     *
+     * @param address the memory address being written
+     * @param pc      address of the instruction writing it
+     */
+    void write(ac_word address, ac_word pc = 0) {
+      if (profile != NULL) profile->access(address);
+      bool trigger = access(address, pc, writeHits, writeMisses, true);
+      if (prefetcher != NULL) runPrefetcher(pc, address, trigger);
+    }
+
+    /**
+     * Returns the current miss-rate of this cache.
+     */
+    double getMissRate() {
+      double hits, misses;
+      hits = (double)(readHits + writeHits);
+      misses = (double)(readMisses + writeMisses);
+      return misses / (hits + misses);
+    }
+
+    /**
+     * Returns the number of accesses this cache served.
+     */
+    uint64_t getNumAccesses() {
+      return readHits + readMisses + writeHits + writeMisses;
+    }
+
+    /**
+     * Returns the average memory access time, in cycles, of the hierarchy
+     * below and including this cache.
+     */
+    double getAMAT() {
+      if (getNumAccesses() == 0) return hitTime;
+      // Victim cache hits take one more cycle instead of the miss penalty
+      double fromVictims = getVictimHitRate();
+      return hitTime + getMissRate() * (fromVictims +
+                                        (1 - fromVictims) * getMissPenalty());
+    }
+
+    /**
+     * Returns the number of blocks of this cache invalidated because an
+     * inclusive level below evicted them.
+     */
+    uint64_t getNumBackInvalidations() {
+      return backInvalidations;
+    }
+
+    /**
+     * Returns the number of dirty blocks written back on eviction.
+     */
+    uint64_t getNumWritebacks() {
+      return writebacks;
+    }
+
+    /**
+     * Returns the number of blocks still dirty, which would be written back if
+     * the cache was flushed.
+     */
+    uint64_t getNumDirtyBlocks() {
+      uint64_t dirty = 0;
+      for (uint32_t set = 0; set < numSets; set++) {
+        dirty += __builtin_popcount(validBits[set] & dirtyBits[set]);
+      }
+      return dirty;
+    }
+
+    /**
+     * Returns the number of bytes read from the next level to fill blocks,
+     * which is main memory for the last level.
+     */
+    uint64_t getMemoryReadBytes() {
+      return fills * blockBytes;
+    }
+
+    /**
+     * Returns the number of bytes written to the next level, by writebacks and
+     * by words written through.
+     */
+    uint64_t getMemoryWriteBytes() {
+      return writebacks * blockBytes + writeThroughs * (1 << BYTE_OFFSET);
+    }
+
+    /**
+     * Returns the fraction of misses served by the victim cache.
+     */
+    double getVictimHitRate() {
+      uint64_t misses = readMisses + writeMisses;
+      if (misses == 0) return 0;
+      return (double) victimHits / misses;
+    }
 
-// Hazard counters
-uint64_t num_branch_data_hazards = 0;
-uint64_t num_load_use_data_hazards = 0;
+    /**
+     * Returns the number of accesses that hit a block whose fetch, started by
+     * an earlier miss, had not completed yet.
+     */
+    uint64_t getNumSecondaryMisses() {
+      return secondaryMisses;
+    }
+
+    /**
+     * Returns the number of misses that found every MSHR busy.
+     */
+    uint64_t getNumMSHRStalls() {
+      return mshrStalls;
+    }
+
+    /**
+     * Returns the cycles misses spent waiting for a free MSHR.
+     */
+    uint64_t getMSHRStallCycles() {
+      return mshrStallCycles;
+    }
+
+    /**
+     * Returns the mean number of misses already outstanding when a miss
+     * arrived.
+     */
+    double getMeanOutstandingMisses() {
+      uint64_t misses = readMisses + writeMisses - victimHits;
+      if (misses == 0) return 0;
+      return (double) outstandingMisses / misses;
+    }
+
+    /**
+     * Returns the largest number of misses already outstanding when a miss
+     * arrived.
+     */
+    uint64_t getMaxOutstandingMisses() {
+      return maxOutstandingMisses;
+    }
+
+    /**
+     * Returns the number of blocks brought in by prefetches.
+     */
+    uint64_t getNumPrefetches() {
+      return prefetches;
+    }
+
+    /**
+     * Returns the fraction of prefetched blocks that were used before being
+     * evicted.
+     */
+    double getPrefetchAccuracy() {
+      if (prefetches == 0) return 0;
+      return (double) usefulPrefetches / prefetches;
+    }
+
+    /**
+     * Returns the fraction of the misses there would be without prefetching
+     * that prefetches removed.
+     */
+    double getPrefetchCoverage() {
+      uint64_t misses = readMisses + writeMisses;
+      if (usefulPrefetches + misses == 0) return 0;
+      return (double) usefulPrefetches / (usefulPrefetches + misses);
+    }
+
+    /**
+     * Returns the fraction of useful prefetches that were used after the
+     * fetch would have completed, taking one access to this cache per cycle.
+     */
+    double getPrefetchTimeliness() {
+      if (usefulPrefetches == 0) return 0;
+      return (double) (usefulPrefetches - latePrefetches) / usefulPrefetches;
+    }
+};
+
+/**
+ * Parameters of one cache level.
+ */
+struct CacheConfig
+{
+  // Only the L3 may be left out
+  bool enabled;
+  uint8_t numIndexBits;
+  uint8_t numBlockIndexBits;
+  uint8_t numWays;
+  ReplacementPolicy policy;
+  WritePolicy writePolicy;
+  AllocatePolicy allocatePolicy;
+  // How the level relates to the levels above it
+  InclusionPolicy inclusion;
+  uint32_t hitTime;
+  // Blocks in the victim cache and number of MSHRs, 0 for none
+  uint8_t victimEntries;
+  uint8_t numMSHRs;
+};
+
+enum PrefetcherKind {NO_PREFETCHER, NEXT_LINE, STRIDE, STREAM};
+
+/**
+ * The microarchitecture being simulated, read once at startup. Everything the
+ * hot path uses is copied out of it into the caches and the BTB when a
+ * processor is built, so being configurable costs nothing per instruction.
+ */
+struct UarchConfig
+{
+  uint32_t btbIndexBits;
+  uint32_t memoryLatency;
+  // Stall cycles the five-stage pipeline adds for an instruction using the
+  // result of the load before it, and for a branch comparing the result of
+  // the ALU instruction or the load before it. A load two instructions
+  // before a branch costs one cycle less than the load right before it.
+  uint32_t loadUseStalls;
+  uint32_t branchALUStalls;
+  uint32_t branchLoadStalls;
+  CacheConfig l1d, l1i, l2, l3;
+  PrefetcherKind prefetcher;
+  // Blocks after a miss, strides ahead, or blocks ahead of each stream
+  uint32_t prefetchDegree;
+  uint32_t prefetchTableBits;
+  uint32_t prefetchStreams;
+  // Whether to measure the grid of cache sizes of StackDistanceProfile
+  bool profile;
+  // Whether to attribute data cache misses, and how many entries to report
+  bool attribution;
+  uint32_t attributionTop;
+};
+
+/**
+ * Returns the configuration used when no option overrides it.
+ */
+UarchConfig default_uarch()
+{
+  UarchConfig config;
+  config.btbIndexBits = 5;
+  config.memoryLatency = MEMORY_LATENCY;
+  config.loadUseStalls = 1;
+  config.branchALUStalls = 1;
+  config.branchLoadStalls = 2;
+
+  // 8KB cache: 128 (2^7) sets * 2 ways * 8 (2^3) words/block
+  CacheConfig l1d = {true, 7, 3, 2, LRU, WRITE_BACK, WRITE_ALLOCATE, NINE, 1,
+                     0, 0};
+  // 1KB cache: 1 (2^0) set * 2 ways * 128 (2^7) words/block
+  CacheConfig l1i = {true, 0, 7, 2, LRU, WRITE_BACK, WRITE_ALLOCATE, NINE, 1,
+                     0, 0};
+  // 64KB cache: 256 (2^8) sets * 4 ways * 16 (2^4) words/block
+  CacheConfig l2 = {true, 8, 4, 4, LRU, WRITE_BACK, WRITE_ALLOCATE,
+                    INCLUSIVE, 10, 0, 0};
+  // 1MB cache: 2048 (2^11) sets * 8 ways * 16 (2^4) words/block
+  CacheConfig l3 = {false, 11, 4, 8, LRU, WRITE_BACK, WRITE_ALLOCATE,
+                    NINE, 30, 0, 0};
+  config.l1d = l1d;
+  config.l1i = l1i;
+  config.l2 = l2;
+  config.l3 = l3;
+
+  config.prefetcher = NO_PREFETCHER;
+  config.prefetchDegree = 2;
+  config.prefetchTableBits = 6;
+  config.prefetchStreams = 4;
+  config.profile = false;
+  config.attribution = false;
+  config.attributionTop = 10;
+  return config;
+}
+
+/**
+ * Stops the simulation on an option that can't be used, rather than running
+ * a design point other than the one asked for.
+ */
+void uarch_error(const std::string& key, const std::string& value)
+{
+  fprintf(stderr, "Invalid microarchitecture option %s=%s\n", key.c_str(),
+          value.c_str());
+  exit(EXIT_FAILURE);
+}
+
+/**
+ * Parses a number in [min, max].
+ */
+uint32_t parse_uarch_number(const std::string& key, const std::string& value,
+                            uint32_t min, uint32_t max)
+{
+  char *end;
+  unsigned long number = strtoul(value.c_str(), &end, 0);
+  if (value.empty() || *end != '\0' || number < min || number > max) {
+    uarch_error(key, value);
+  }
+  return number;
+}
+
+/**
+ * Parses a switch, given as 0 or 1 or as a JSON true or false.
+ */
+bool parse_uarch_bool(const std::string& key, const std::string& value)
+{
+  if (value == "true") return true;
+  if (value == "false") return false;
+  return parse_uarch_number(key, value, 0, 1);
+}
 
 /**
- * Check for a load-use data hazard.
- * There's a load-use data hazard when a register that is being loaded by a load
- * instruction has not yet become available when it is needed by another
- * instruction.
- *
- * @param rs register being used as rs by the current instruction
- * @param rt register being used as rt by the current instruction
+ * Parses one of a list of names, returning its position in the list.
  */
-void check_load_use_hazard(int rs, int rt)
+int parse_uarch_name(const std::string& key, const std::string& value,
+                     const char *const *names)
 {
-  int rd = lastInstruction.getDestinationRegister();
-  if (lastInstruction.isLoad() && (rs == rd || rt == rd)) {
-    dbg_printf("Load-Use Data Hazard!\n");
-    ++num_load_use_data_hazards;
-    return;
-  }
-
-  rd = lastLastInstruction.getDestinationRegister();
-  if (lastInstruction.isNop() &&
-      lastLastInstruction.isLoad() && (rs == rd || rt == rd)) {
-    dbg_printf("Compiler-Handled Load-Use Data Hazard!\n");
-    ++num_load_use_data_hazards;
-    return;
+  for (int i = 0; names[i] != NULL; i++) {
+    if (value == names[i]) return i;
   }
+  uarch_error(key, value);
+  return 0;
 }
 
 /**
- * Same as above, but to be used by I-type instructions that only use one of
- * the registers as source.
+ * Sets a field of a cache level.
  *
- * @param rs register being used as source by the current instruction
+ * @returns whether the field exists
  */
-void check_load_use_hazard(int rs) {
-  check_load_use_hazard(rs, -2);
+bool set_cache_option(CacheConfig& cache, const std::string& key,
+                      const std::string& field, const std::string& value)
+{
+  static const char *const policies[] = {"lru", "plru", "fifo", "random", NULL};
+  static const char *const writes[] = {"back", "through", NULL};
+  static const char *const allocates[] = {"allocate", "no_allocate", NULL};
+  static const char *const inclusions[] = {"inclusive", "exclusive", "nine",
+                                           NULL};
+
+  if (field == "index_bits") {
+    cache.numIndexBits = parse_uarch_number(key, value, 0, 20);
+  } else if (field == "block_bits") {
+    cache.numBlockIndexBits = parse_uarch_number(key, value, 0, 10);
+  } else if (field == "ways") {
+    cache.numWays = parse_uarch_number(key, value, 1, 32);
+  } else if (field == "policy") {
+    cache.policy = (ReplacementPolicy) parse_uarch_name(key, value, policies);
+  } else if (field == "write") {
+    cache.writePolicy = (WritePolicy) parse_uarch_name(key, value, writes);
+  } else if (field == "allocate") {
+    cache.allocatePolicy =
+      (AllocatePolicy) parse_uarch_name(key, value, allocates);
+  } else if (field == "inclusion") {
+    cache.inclusion =
+      (InclusionPolicy) parse_uarch_name(key, value, inclusions);
+  } else if (field == "hit_time") {
+    cache.hitTime = parse_uarch_number(key, value, 0, 100000);
+  } else if (field == "victim_entries") {
+    cache.victimEntries = parse_uarch_number(key, value, 0, 32);
+  } else if (field == "mshrs") {
+    cache.numMSHRs = parse_uarch_number(key, value, 0, 64);
+  } else {
+    return false;
+  }
+  return true;
 }
 
 /**
- * Check for a branch data hazard.
- * There's a branch data hazard when a comparison register is a destination of
- * a preceding ALU instruction, preceding load instruction or second preceding
- * load instruction.
- *
- * @param rs register being used as rs by the current instruction
- * @param rt register being used as rt by the current instruction
+ * Sets one option, such as l1d_ways=4 or prefetcher=stride.
  */
-void check_branch_data_hazard(int rs, int rt)
+void set_uarch_option(UarchConfig& config, const std::string& key,
+                      const std::string& value)
 {
-  // Early return
-  if (!lastInstruction.isALU() &&
-      !lastInstruction.isLoad() &&
-      !lastLastInstruction.isLoad()) {
+  static const char *const prefetchers[] = {"none", "next_line", "stride",
+                                            "stream", NULL};
+  static const char *const levels[] = {"l1d_", "l1i_", "l2_", "l3_", NULL};
+  CacheConfig *caches[] = {&config.l1d, &config.l1i, &config.l2, &config.l3};
+
+  // Every other level is always there
+  if (key == "l3_enabled") {
+    config.l3.enabled = parse_uarch_bool(key, value);
     return;
   }
 
-  int rd = lastInstruction.getDestinationRegister();
-  if (lastInstruction.isLoad() && (rs == rd || rt == rd)) {
-    dbg_printf("Branch Data Hazard!\n");
-    num_branch_data_hazards += 2;
-    return;
+  for (int i = 0; levels[i] != NULL; i++) {
+    size_t length = strlen(levels[i]);
+    if (key.compare(0, length, levels[i]) == 0) {
+      if (!set_cache_option(*caches[i], key, key.substr(length), value)) {
+        uarch_error(key, value);
+      }
+      return;
+    }
   }
 
-  if (lastInstruction.isALU() && (rs == rd || rt == rd)) {
-    dbg_printf("Branch Data Hazard!\n");
-    ++num_branch_data_hazards;
-    return;
+  if (key == "btb_bits") {
+    config.btbIndexBits = parse_uarch_number(key, value, 0, 20);
+  } else if (key == "memory_latency") {
+    config.memoryLatency = parse_uarch_number(key, value, 0, 100000);
+  } else if (key == "load_use_stalls") {
+    config.loadUseStalls = parse_uarch_number(key, value, 0, 100);
+  } else if (key == "branch_alu_stalls") {
+    config.branchALUStalls = parse_uarch_number(key, value, 0, 100);
+  } else if (key == "branch_load_stalls") {
+    config.branchLoadStalls = parse_uarch_number(key, value, 0, 100);
+  } else if (key == "prefetcher") {
+    config.prefetcher = (PrefetcherKind) parse_uarch_name(key, value,
+                                                          prefetchers);
+  } else if (key == "prefetch_degree") {
+    config.prefetchDegree = parse_uarch_number(key, value, 1, 64);
+  } else if (key == "prefetch_table_bits") {
+    config.prefetchTableBits = parse_uarch_number(key, value, 0, 16);
+  } else if (key == "prefetch_streams") {
+    config.prefetchStreams = parse_uarch_number(key, value, 1, 64);
+  } else if (key == "profile") {
+    config.profile = parse_uarch_bool(key, value);
+  } else if (key == "attribution") {
+    config.attribution = parse_uarch_bool(key, value);
+  } else if (key == "attribution_top") {
+    config.attributionTop = parse_uarch_number(key, value, 1, 1000);
+  } else {
+    uarch_error(key, value);
   }
+}
 
-  rd = lastLastInstruction.getDestinationRegister();
-  if (lastLastInstruction.isLoad() && (rs == rd || rt == rd)) {
-    dbg_printf("Branch Data Hazard!\n");
-    ++num_branch_data_hazards;
-    return;
+/**
+ * Applies a list of options. Both "key=value" pairs separated by commas,
+ * spaces or new lines and a flat JSON object are accepted; # starts a comment.
+ */
+void parse_uarch_options(UarchConfig& config, std::string text)
+{
+  std::string tokens;
+  bool comment = false;
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+    if (c == '#') comment = true;
+    if (c == '\n') comment = false;
+    if (comment || strchr("{}\",;\t\r\n", c) != NULL) c = ' ';
+    if (c == '=' || c == ':') {
+      tokens += " = ";
+    } else {
+      tokens += c;
+    }
+  }
+
+  char key[64], value[64];
+  const char *cursor = tokens.c_str();
+  int consumed;
+  while (sscanf(cursor, " %63[^ =] = %63s%n", key, value, &consumed) == 2) {
+    set_uarch_option(config, key, value);
+    cursor += consumed;
   }
+  if (sscanf(cursor, " %63s", key) == 1) uarch_error(key, "");
 }
 
 /**
- * Same as above, but to be used by branch instructions that only use one of
- * the registers as source.
- *
- * @param rs register being used as source by the current instruction
+ * Stops on a hierarchy the caches can't model: an exclusive level with larger
+ * blocks than a level above it would give up the part of a block that level
+ * doesn't take.
  */
-void check_branch_data_hazard(int rs) {
-  check_branch_data_hazard(rs, -2);
+void check_uarch(const UarchConfig& config)
+{
+  bool l2TooLarge =
+    config.l2.numBlockIndexBits > config.l1d.numBlockIndexBits ||
+    config.l2.numBlockIndexBits > config.l1i.numBlockIndexBits;
+  bool l3TooLarge =
+    config.l3.numBlockIndexBits > config.l2.numBlockIndexBits;
+
+  if ((config.l2.inclusion == EXCLUSIVE && l2TooLarge) ||
+      (config.l3.enabled && config.l3.inclusion == EXCLUSIVE && l3TooLarge)) {
+    fprintf(stderr, "An exclusive cache can't have larger blocks than the "
+            "caches above it\n");
+    exit(EXIT_FAILURE);
+  }
 }
 
 /**
- * An entry in the Branch Target Buffer.
+ * Returns the value of a simulator option such as --uarch=, or an empty
+ * string. ArchC doesn't hand its own command line to the model, so it is read
+ * back from /proc.
  */
-class BranchTargetBufferEntry
+std::string command_line_option(const std::string& prefix)
 {
-    enum State {STRONG_TAKEN, WEAK_TAKEN, WEAK_NOT_TAKEN, STRONG_NOT_TAKEN};
-
-    State taken;
-    ac_word target;
-
-  public:
+  FILE *file = fopen("/proc/self/cmdline", "r");
+  if (file == NULL) return "";
 
-    BranchTargetBufferEntry() {
-      target = 0;
-      taken = WEAK_NOT_TAKEN;
+  std::string argument;
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    if (c != '\0') {
+      argument += (char) c;
+      continue;
     }
-
-    /**
-     * Returns the cached branch target.
-     */
-    ac_word getPredictedTarget() {
-      return target;
+    if (argument.compare(0, prefix.size(), prefix) == 0) {
+      fclose(file);
+      return argument.substr(prefix.size());
     }
+    argument.clear();
+  }
+  fclose(file);
+  return "";
+}
 
-    /**
-     * Returns a guess on whether we should branch or not.
-     */
-    bool getPrediction() {
-      return taken == STRONG_TAKEN || taken == WEAK_TAKEN;
-    }
+/**
+ * Returns the simulator's --uarch= option, falling back to the MIPS1_UARCH
+ * environment variable.
+ */
+std::string uarch_option()
+{
+  std::string option = command_line_option("--uarch=");
+  if (!option.empty()) return option;
 
-    /**
-     * Updates the guess based on whether the branch was actually taken or not.
-     *
-     * @param branchTaken  whether the branch was taken or not
-     * @param branchTarget the branch's target address
-     */
-    void updatePrediction(bool branchTaken, ac_word branchTarget) {
-      target = branchTarget;
-      switch (taken) {
-        case STRONG_TAKEN:
-          taken = branchTaken ? STRONG_TAKEN : WEAK_TAKEN;
-          break;
-        case WEAK_TAKEN:
-          taken = branchTaken ? STRONG_TAKEN : WEAK_NOT_TAKEN;
-          break;
-        case WEAK_NOT_TAKEN:
-          taken = branchTaken ? WEAK_TAKEN : STRONG_NOT_TAKEN;
-          break;
-        case STRONG_NOT_TAKEN:
-          taken = branchTaken ? WEAK_NOT_TAKEN : STRONG_NOT_TAKEN;
-          break;
-        default:
-          break;
-      }
+  const char *variable = getenv("MIPS1_UARCH");
+  return variable != NULL ? variable : "";
+}
+
+/**
+ * Returns the configuration, parsed on first use from --uarch= or
+ * MIPS1_UARCH. The option holds either the options themselves or the name of
+ * a file with them.
+ */
+const UarchConfig& uarch()
+{
+  static UarchConfig config;
+  static bool parsed = false;
+  if (parsed) return config;
+
+  config = default_uarch();
+  std::string option = uarch_option();
+  if (option.find_first_of("=:") == std::string::npos && !option.empty()) {
+    FILE *file = fopen(option.c_str(), "r");
+    if (file == NULL) {
+      fprintf(stderr, "Can't open microarchitecture file %s\n",
+              option.c_str());
+      exit(EXIT_FAILURE);
     }
-};
+    std::string text;
+    int c;
+    while ((c = fgetc(file)) != EOF) text += (char) c;
+    fclose(file);
+    parse_uarch_options(config, text);
+  } else {
+    parse_uarch_options(config, option);
+  }
+  check_uarch(config);
+
+  parsed = true;
+  return config;
+}
 
 /**
- * A small cache indexed by the lower portion of the address of the branch
- * instruction that says whether the branch was recently taken or not.
- * 
- * It also stores the target address of the branch so that the PC can be updated
- * right away when prediction says branch should be taken and a new cycle just
- * for the computation of target address is avoided.
+ * Returns the symbols of the program given to --load=, read on first use.
+ * Without them misses are still attributed, by address only.
  */
-class BranchTargetBuffer
+const SymbolTable& guest_symbols()
 {
-    static const int BYTE_OFFSET = 2;
+  static SymbolTable symbols;
+  static bool loaded = false;
+  if (loaded) return symbols;
 
-    uint32_t numIndexBits;
-    uint64_t numPredictions;
-    uint64_t numWrongPredictions;
-    uint64_t numWrongPredictedTargets;
-    std::vector<BranchTargetBufferEntry> predictions;
+  std::string path = command_line_option("--load=");
+  if (!path.empty() && !symbols.load(path.c_str())) {
+    fprintf(stderr, "No symbols in %s, misses reported by address only\n",
+            path.c_str());
+  }
+  loaded = true;
+  return symbols;
+}
 
-    uint32_t getIndex(ac_word address) {
-      return (address >> BYTE_OFFSET) & ~(0xFFFFFFFF << numIndexBits);
-    }
+/**
+ * Builds a cache level, or a single block stand-in if it is disabled.
+ */
+Cache make_cache(const CacheConfig& config)
+{
+  if (!config.enabled) return Cache(0, 0);
+
+  Cache cache(config.numIndexBits, config.numBlockIndexBits, config.numWays,
+              config.policy, config.writePolicy, config.allocatePolicy);
+  cache.setInclusion(config.inclusion);
+  cache.setHitTime(config.hitTime);
+  cache.setMemoryLatency(uarch().memoryLatency);
+  cache.setVictimCache(config.victimEntries);
+  cache.setMSHRs(config.numMSHRs);
+  return cache;
+}
 
+/**
+ * Builds the prefetcher the configuration asks for, if any.
+ */
+Prefetcher *make_prefetcher(const UarchConfig& config)
+{
+  switch (config.prefetcher) {
+    case NEXT_LINE:
+      return new NextLinePrefetcher(config.prefetchDegree);
+    case STRIDE:
+      return new StridePrefetcher(config.prefetchTableBits,
+                                  config.prefetchDegree);
+    case STREAM:
+      return new StreamPrefetcher(config.prefetchStreams,
+                                  config.prefetchDegree);
+    default:
+      return NULL;
+  }
+}
+
+// Size of a host cache line
+#define HOST_CACHE_LINE 64
+
+/**
+ * Everything a processor keeps track of between instructions: hazards, branch
+ * prediction and its cache hierarchy. Each processor owns one, aligned and
+ * padded to host cache lines so that the counters of two processors never
+ * share a line.
+ */
+class ProcessorStats
+{
   public:
 
-    BranchTargetBuffer(uint32_t numIndexBits)
-      : numIndexBits(numIndexBits)
-      , numPredictions(0)
-      , numWrongPredictions(0)
-      , numWrongPredictedTargets(0)
-      , predictions(1 << numIndexBits)
-    {}
+    // Address of the instruction being executed
+    ac_word current_instruction;
+    Instruction lastInstruction;
+    Instruction lastLastInstruction;
+
+    // Hazard counters
+    uint64_t num_branch_data_hazards;
+    uint64_t num_load_use_data_hazards;
+
+    // Stall cycles of each hazard, copied from the configuration
+    uint32_t load_use_stalls;
+    uint32_t branch_alu_stalls;
+    uint32_t branch_load_stalls;
+
+    BranchTargetBuffer prediction_buffer;
+
+    Cache data_cache;
+    Cache instructions_cache;
+    Cache l2_cache;
+    // Only linked in when enabled
+    Cache l3_cache;
+
+    // NULL unless enabled
+    StackDistanceProfile *data_profile;
+    StackDistanceProfile *instructions_profile;
+    Prefetcher *data_prefetcher;
+    MissAttribution *data_attribution;
 
     /**
-     * Updates memory with the latest decision for this branch instruction.
-     * Also, checks whether prediction would've been correct or not.
-     *
-     * @param address      the address of the branch instruction
-     * @param branchTaken  whether the branch was taken or not
-     * @param branchTarget the branch's target address
+     * Builds the caches as configured and links them into a hierarchy: both
+     * L1 caches miss into the L2, which misses into the L3 when there is one.
+     * Profiles and the prefetcher, when enabled, watch the L1 caches, and the
+     * attribution the L1 data cache.
      */
-    void update(ac_word address, bool branchTaken, ac_word branchTarget) {
-      BranchTargetBufferEntry& entry = predictions[getIndex(address)];
-      bool prediction = entry.getPrediction();
-      if (prediction != branchTaken) {
-        ++numWrongPredictions;
-      } else if (prediction && entry.getPredictedTarget() != branchTarget) {
-        ++numWrongPredictedTargets;
+    ProcessorStats()
+      : current_instruction(0)
+      , num_branch_data_hazards(0)
+      , num_load_use_data_hazards(0)
+      , load_use_stalls(uarch().loadUseStalls)
+      , branch_alu_stalls(uarch().branchALUStalls)
+      , branch_load_stalls(uarch().branchLoadStalls)
+      , prediction_buffer(uarch().btbIndexBits)
+      , data_cache(make_cache(uarch().l1d))
+      , instructions_cache(make_cache(uarch().l1i))
+      , l2_cache(make_cache(uarch().l2))
+      , l3_cache(make_cache(uarch().l3))
+      , data_profile(NULL)
+      , instructions_profile(NULL)
+      , data_prefetcher(make_prefetcher(uarch()))
+      , data_attribution(NULL)
+    {
+      data_cache.setNextLevel(&l2_cache);
+      instructions_cache.setNextLevel(&l2_cache);
+      if (uarch().l3.enabled) l2_cache.setNextLevel(&l3_cache);
+
+      if (uarch().profile) {
+        // 2 to 16 words/block, 1 to 1024 sets, 1 to 16 ways
+        data_profile = new StackDistanceProfile(1, 4, 0, 10, 16);
+        instructions_profile = new StackDistanceProfile(1, 4, 0, 10, 16);
+        data_cache.setProfile(data_profile);
+        instructions_cache.setProfile(instructions_profile);
+      }
+      if (data_prefetcher != NULL) data_cache.setPrefetcher(data_prefetcher);
+      if (uarch().attribution) {
+        data_attribution = new MissAttribution();
+        data_cache.setAttribution(data_attribution);
       }
-      ++numPredictions;
-
-      entry.updatePrediction(branchTaken, branchTarget);
     }
 
-    uint64_t getNumPredictions() {
-      return numPredictions;
+    ~ProcessorStats() {
+      delete data_profile;
+      delete instructions_profile;
+      delete data_prefetcher;
+      delete data_attribution;
     }
 
     /**
-     * Returns the number of times the "take or not" prediction was wrong.
+     * Check for a load-use data hazard.
+     * There's a load-use data hazard when a register that is being loaded by a
+     * load instruction has not yet become available when it is needed by
+     * another instruction. Both it and the nop a compiler puts in its place
+     * cost load_use_stalls cycles.
+     *
+     * @param rs register being used as rs by the current instruction
+     * @param rt register being used as rt by the current instruction
      */
-    uint64_t getNumWrongPredictions() {
-      return numWrongPredictions;
+    void checkLoadUseHazard(int rs, int rt) {
+      int rd = lastInstruction.getDestinationRegister();
+      if (lastInstruction.isLoad() && (rs == rd || rt == rd)) {
+        dbg_printf("Load-Use Data Hazard!\n");
+        num_load_use_data_hazards += load_use_stalls;
+        return;
+      }
+
+      rd = lastLastInstruction.getDestinationRegister();
+      if (lastInstruction.isNop() &&
+          lastLastInstruction.isLoad() && (rs == rd || rt == rd)) {
+        dbg_printf("Compiler-Handled Load-Use Data Hazard!\n");
+        num_load_use_data_hazards += load_use_stalls;
+        return;
+      }
     }
 
     /**
-     * Returns the number of times the prediction was correctly "take branch",
-     * but the cached target was wrong.
+     * Same as above, but to be used by I-type instructions that only use one
+     * of the registers as source.
+     *
+     * @param rs register being used as source by the current instruction
      */
-    uint64_t getNumWrongPredictedTargets() {
-      return numWrongPredictedTargets;
+    void checkLoadUseHazard(int rs) {
+      checkLoadUseHazard(rs, -2);
     }
-};
 
-ac_word current_instruction;
-// Buffer with 32 positions
-BranchTargetBuffer prediction_buffer(5);
+    /**
+     * Check for a branch data hazard.
+     * There's a branch data hazard when a comparison register is a destination
+     * of a preceding ALU instruction, preceding load instruction or second
+     * preceding load instruction, and it costs branch_alu_stalls cycles,
+     * branch_load_stalls cycles or one cycle less than that, respectively.
+     *
+     * @param rs register being used as rs by the current instruction
+     * @param rt register being used as rt by the current instruction
+     */
+    void checkBranchDataHazard(int rs, int rt) {
+      // Early return
+      if (!lastInstruction.isALU() &&
+          !lastInstruction.isLoad() &&
+          !lastLastInstruction.isLoad()) {
+        return;
+      }
 
-/**
- * A simple cache block without the actual data.
- */
-class CacheBlock
-{
-    bool valid;
-    uint32_t tag;
+      int rd = lastInstruction.getDestinationRegister();
+      if (lastInstruction.isLoad() && (rs == rd || rt == rd)) {
+        dbg_printf("Branch Data Hazard!\n");
+        num_branch_data_hazards += branch_load_stalls;
+        return;
+      }
 
-  public:
+      if (lastInstruction.isALU() && (rs == rd || rt == rd)) {
+        dbg_printf("Branch Data Hazard!\n");
+        num_branch_data_hazards += branch_alu_stalls;
+        return;
+      }
 
-    CacheBlock() {
-      tag = 0;
-      valid = false;
+      rd = lastLastInstruction.getDestinationRegister();
+      if (lastLastInstruction.isLoad() && (rs == rd || rt == rd)) {
+        dbg_printf("Branch Data Hazard!\n");
+        if (branch_load_stalls > 0) {
+          num_branch_data_hazards += branch_load_stalls - 1;
+        }
+        return;
+      }
     }
 
     /**
-     * Saves the information about the address that was loaded into this block.
+     * Same as above, but to be used by branch instructions that only use one
+     * of the registers as source.
+     *
+     * @param rs register being used as source by the current instruction
      */
-    void set(uint32_t tag) {
-      valid = true;
-      this->tag = tag;
-    }
-
-    uint32_t getTag() {
-      return tag;
+    void checkBranchDataHazard(int rs) {
+      checkBranchDataHazard(rs, -2);
     }
+} __attribute__((aligned(HOST_CACHE_LINE)));
 
-    bool isValid() {
-      return valid;
-    }
-};
+// Slots of the per-processor table, a power of two above the number of
+// processors any platform has
+#define PER_PROCESSOR_SLOTS 64
 
 /**
- * A simple direct-mapped cache with variable number of word-sized blocks.
+ * State of every processor, in a hash table keyed by the address of the
+ * processor's ISA object. Each state starts on a host cache line of its own
+ * and is destroyed with the table, when the simulator exits.
  */
-class Cache
+template <class T>
+class ProcessorTable
 {
-    static const int BYTE_OFFSET = 2;
-
-    uint64_t readHits, readMisses;
-    uint64_t writeHits, writeMisses;
-    uint32_t numIndexBits, numTagBits;
-
-    uint32_t numBlocks;
-    std::vector<CacheBlock> blocks;
-
-    /**
-     * Simulates a cache access (read or write) and checks whether it would've
-     * been a hit or not.
-     *
-     * @param address     the memory address being accessed
-     * @param hitCounter  pointer to the hit counter
-     * @param missCounter pointer to the miss counter
-     */
-    void access(
-        ac_word address,
-        uint64_t& hitCounter,
-        uint64_t& missCounter) {
-      uint32_t tag, index;
-
-      address >>= AC_WORDSIZE - numTagBits - numIndexBits;
-      tag = address >> numIndexBits;
-      index = address & ~(0xFFFFFFFF << numIndexBits);
-
-      CacheBlock& block = blocks[index];
-      if (block.isValid() && block.getTag() == tag) {
-        ++hitCounter;
-      } else {
-        ++missCounter;
-        block.set(tag);
-      }
-    }
+    const void *keys[PER_PROCESSOR_SLOTS];
+    T *states[PER_PROCESSOR_SLOTS];
 
   public:
 
-    Cache(uint32_t numIndexBits, uint32_t numBlockIndexBits)
-      : readHits(0)
-      , readMisses(0)
-      , writeHits(0)
-      , writeMisses(0)
-      , numIndexBits(numIndexBits)
-      , numTagBits(AC_WORDSIZE - numIndexBits - numBlockIndexBits - BYTE_OFFSET)
-      , numBlocks(1 << numIndexBits)
-      , blocks(numBlocks)
-    {}
-
-    /**
-     * Simulates a cache read and checks whether it would've been a hit or not.
-     *
-     * @param address the memory address being read
-     */
-    void read(ac_word address) {
-      access(address, readHits, readMisses);
+    ProcessorTable() {
+      for (int i = 0; i < PER_PROCESSOR_SLOTS; i++) {
+        keys[i] = NULL;
+        states[i] = NULL;
+      }
     }
 
-    /**
-     * Simulates a cache write and checks whether it would've been a hit or not.
-     *
-     * @param address the memory address being written
-     */
-    void write(ac_word address) {
-      access(address, writeHits, writeMisses);
+    ~ProcessorTable() {
+      for (int i = 0; i < PER_PROCESSOR_SLOTS; i++) {
+        if (states[i] == NULL) continue;
+        states[i]->~T();
+        free(states[i]);
+      }
     }
 
     /**
-     * Returns the current miss-rate of this cache.
+     * Returns the state of a processor, built on first use. The first probe
+     * almost always hits.
      */
-    double getMissRate() {
-      double hits, misses;
-      hits = (double)(readHits + writeHits);
-      misses = (double)(readMisses + writeMisses);
-      return misses / (hits + misses);
+    T& get(const void *processor) {
+      unsigned int slot = (uint64_t) (uintptr_t) processor *
+                          0x9E3779B97F4A7C15ULL >> 32 &
+                          (PER_PROCESSOR_SLOTS - 1);
+      for (int probes = 0; keys[slot] != processor; probes++) {
+        if (probes == PER_PROCESSOR_SLOTS) {
+          fprintf(stderr, "More than %d processors\n", PER_PROCESSOR_SLOTS);
+          exit(EXIT_FAILURE);
+        }
+        if (keys[slot] == NULL) {
+          void *memory;
+          if (posix_memalign(&memory, HOST_CACHE_LINE, sizeof(T)) != 0) {
+            throw std::bad_alloc();
+          }
+          states[slot] = new (memory) T();
+          keys[slot] = processor;
+          break;
+        }
+        slot = (slot + 1) & (PER_PROCESSOR_SLOTS - 1);
+      }
+      return *states[slot];
     }
 };
 
-// 8KB cache: 256 (2^8) lines * 8 (2^3) words/block
-Cache data_cache(8, 3);
-// 1KB cache: 2 (2^1) lines * 128 (2^7) words/block
-Cache instructions_cache(1, 7);
+/**
+ * The behavior methods are shared by every mips1 instance, so state that
+ * belongs to a single processor is kept here.
+ */
+template <class T>
+T& per_processor(const void *processor)
+{
+  static ProcessorTable<T> table;
+  return table.get(processor);
+}
+
+/**
+ * Statistics of the processor whose instruction is being executed, looked up
+ * once per instruction by the generic instruction behavior. It is only valid
+ * from there until the behaviors of that same instruction, which read it
+ * before any memory access can let another processor run. Each host thread
+ * has its own, so processors simulated in parallel don't share it.
+ */
+static __thread ProcessorStats *current_stats;
 
 //!Generic instruction behavior method.
 void ac_behavior( instruction )
 {
+  current_stats = &per_processor<ProcessorStats>(this);
+  ProcessorStats &stats = *current_stats;
   dbg_printf("----- PC=%#x ----- %lld\n", (int) ac_pc, ac_instr_counter);
   //  dbg_printf("----- PC=%#x NPC=%#x ----- %lld\n", (int) ac_pc, (int)npc, ac_instr_counter);
 #ifndef NO_NEED_PC_UPDATE
-  current_instruction = ac_pc;
-  instructions_cache.read(ac_pc);
+  stats.current_instruction = ac_pc;
+  stats.instructions_cache.read(ac_pc, ac_pc);
   ac_pc = npc;
   npc = ac_pc + 4;
 #endif
@@ -487,15 +2444,17 @@ void ac_behavior( instruction )
 //! Instruction Format behavior methods.
 void ac_behavior( Type_R )
 {
-  check_load_use_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs, rt);
 }
 
 void ac_behavior( Type_I ){}
 
 void ac_behavior( Type_J )
 {
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  ProcessorStats &stats = *current_stats;
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 }
 
 //!Behavior called before starting simulation
@@ -511,23 +2470,106 @@ void ac_behavior(begin)
   hi = 0;
   lo = 0;
 
-  num_branch_data_hazards = 0;
-  num_load_use_data_hazards = 0;
+  // Build this processor's caches before it runs
+  per_processor<ProcessorStats>(this);
+}
+
+/**
+ * Prints how the victim cache and the MSHRs of a level did, if it has them.
+ */
+void print_miss_buffers(const char *name, Cache& cache,
+                        const CacheConfig& config)
+{
+  if (config.victimEntries > 0) {
+    dbg_printf("@@@ %s Victim Hits: %.2lf%% of misses @@@\n", name,
+               100 * cache.getVictimHitRate());
+  }
+  if (config.numMSHRs > 0) {
+    dbg_printf(
+      "@@@ %s MSHRs: %llu secondary misses, %llu stalls (%llu cycles), "
+      "%.2lf mean / %llu max outstanding @@@\n",
+      name,
+      cache.getNumSecondaryMisses(),
+      cache.getNumMSHRStalls(),
+      cache.getMSHRStallCycles(),
+      cache.getMeanOutstandingMisses(),
+      cache.getMaxOutstandingMisses()
+    );
+  }
 }
 
 //!Behavior called after finishing simulation
 void ac_behavior(end)
 {
+  ProcessorStats &stats = per_processor<ProcessorStats>(this);
   double miss_rate;
   dbg_printf("@@@ end behavior @@@\n");
-  miss_rate = data_cache.getMissRate();
+  miss_rate = stats.data_cache.getMissRate();
   dbg_printf("@@@ Data Cache Miss-Rate: %.2lf% @@@\n", 100 * miss_rate);
-  miss_rate = instructions_cache.getMissRate();
+  dbg_printf(
+    "@@@ Data Cache Writebacks: %llu (%llu blocks still dirty) @@@\n",
+    stats.data_cache.getNumWritebacks(),
+    stats.data_cache.getNumDirtyBlocks()
+  );
+  dbg_printf(
+    "@@@ Data Cache Traffic to L2: %llu bytes read, %llu bytes written @@@\n",
+    stats.data_cache.getMemoryReadBytes(),
+    stats.data_cache.getMemoryWriteBytes()
+  );
+  if (stats.data_prefetcher != NULL) {
+    dbg_printf("@@@ Data Cache Prefetches: %llu @@@\n",
+               stats.data_cache.getNumPrefetches());
+    dbg_printf(
+      "@@@ Data Cache Prefetch Accuracy: %.2lf%%, Coverage: %.2lf%%, "
+      "Timeliness: %.2lf%% @@@\n",
+      100 * stats.data_cache.getPrefetchAccuracy(),
+      100 * stats.data_cache.getPrefetchCoverage(),
+      100 * stats.data_cache.getPrefetchTimeliness()
+    );
+  }
+  print_miss_buffers("Data Cache", stats.data_cache, uarch().l1d);
+  miss_rate = stats.instructions_cache.getMissRate();
   dbg_printf("@@@ Instructions Cache Miss-Rate: %.2lf% @@@\n", 100 * miss_rate);
-  uint64_t total = prediction_buffer.getNumPredictions();
-  uint64_t wrong1 = prediction_buffer.getNumWrongPredictions();
+  print_miss_buffers("Instructions Cache", stats.instructions_cache,
+                     uarch().l1i);
+  miss_rate = stats.l2_cache.getMissRate();
+  dbg_printf("@@@ L2 Cache Miss-Rate: %.2lf%% of %llu accesses @@@\n",
+             100 * miss_rate, stats.l2_cache.getNumAccesses());
+  dbg_printf("@@@ L2 Cache Writebacks: %llu @@@\n",
+             stats.l2_cache.getNumWritebacks());
+  print_miss_buffers("L2 Cache", stats.l2_cache, uarch().l2);
+  dbg_printf("@@@ L1 Back-Invalidations: %llu data, %llu instructions @@@\n",
+             stats.data_cache.getNumBackInvalidations(),
+             stats.instructions_cache.getNumBackInvalidations());
+  if (uarch().l3.enabled) {
+    miss_rate = stats.l3_cache.getMissRate();
+    dbg_printf("@@@ L3 Cache Miss-Rate: %.2lf%% of %llu accesses @@@\n",
+               100 * miss_rate, stats.l3_cache.getNumAccesses());
+    dbg_printf("@@@ L3 Cache Writebacks: %llu @@@\n",
+               stats.l3_cache.getNumWritebacks());
+    print_miss_buffers("L3 Cache", stats.l3_cache, uarch().l3);
+  }
+  Cache& last_level = uarch().l3.enabled ? stats.l3_cache : stats.l2_cache;
+  dbg_printf(
+    "@@@ Memory Traffic: %llu bytes read, %llu bytes written @@@\n",
+    last_level.getMemoryReadBytes(),
+    last_level.getMemoryWriteBytes()
+  );
+  dbg_printf("@@@ Data AMAT: %.2lf cycles @@@\n", stats.data_cache.getAMAT());
+  dbg_printf("@@@ Instructions AMAT: %.2lf cycles @@@\n",
+             stats.instructions_cache.getAMAT());
+  if (stats.data_profile != NULL) {
+    stats.data_profile->print("Data Cache");
+    stats.instructions_profile->print("Instructions Cache");
+  }
+  if (stats.data_attribution != NULL) {
+    stats.data_attribution->print("Data Cache", guest_symbols(),
+                                  uarch().attributionTop);
+  }
+  uint64_t total = stats.prediction_buffer.getNumPredictions();
+  uint64_t wrong1 = stats.prediction_buffer.getNumWrongPredictions();
   dbg_printf("@@@ Number of Wrong Predictions: %llu/%llu @@@\n", wrong1, total);
-  unsigned int wrong2 = prediction_buffer.getNumWrongPredictedTargets();
+  unsigned int wrong2 = stats.prediction_buffer.getNumWrongPredictedTargets();
   dbg_printf(
     "@@@ Number of Right Predictions with Wrong Target: %llu/%llu @@@\n",
     wrong2,
@@ -536,100 +2578,106 @@ void ac_behavior(end)
   dbg_printf("@@@ Number of Control Hazards: %llu @@@\n", wrong1 + wrong2);
   dbg_printf(
     "@@@ Number of Branch Data Hazards: %llu @@@\n",
-    num_branch_data_hazards
+    stats.num_branch_data_hazards
   );
   dbg_printf(
     "@@@ Number of Load-Use Data Hazards: %llu @@@\n",
-    num_load_use_data_hazards
+    stats.num_load_use_data_hazards
   );
 }
 
 //!Instruction lb behavior method.
 void ac_behavior( lb )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   char byte;
   dbg_printf("lb r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   ac_word addr = RB[rs] + imm;
-  data_cache.read(addr);
+  stats.data_cache.read(addr, stats.current_instruction);
   byte = DM.read_byte(RB[rs]+ imm);
   RB[rt] = (ac_Sword)byte ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction lbu behavior method.
 void ac_behavior( lbu )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   unsigned char byte;
   dbg_printf("lbu r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   ac_word addr = RB[rs] + imm;
-  data_cache.read(addr);
+  stats.data_cache.read(addr, stats.current_instruction);
   byte = DM.read_byte(addr);
   RB[rt] = byte ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction lh behavior method.
 void ac_behavior( lh )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   short int half;
   dbg_printf("lh r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   ac_word addr = RB[rs] + imm;
-  data_cache.read(addr);
+  stats.data_cache.read(addr, stats.current_instruction);
   half = DM.read_half(addr);
   RB[rt] = (ac_Sword)half ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction lhu behavior method.
 void ac_behavior( lhu )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   unsigned short int  half;
   ac_word addr = RB[rs] + imm;
-  data_cache.read(addr);
+  stats.data_cache.read(addr, stats.current_instruction);
   half = DM.read_half(addr);
   RB[rt] = half ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction lw behavior method.
 void ac_behavior( lw )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("lw r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   ac_word addr = RB[rs] + imm;
-  data_cache.read(addr);
+  stats.data_cache.read(addr, stats.current_instruction);
   RB[rt] = DM.read(addr);
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction lwl behavior method.
 void ac_behavior( lwl )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("lwl r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
@@ -637,21 +2685,22 @@ void ac_behavior( lwl )
 
   addr = RB[rs] + imm;
   offset = (addr & 0x3) * 8;
-  data_cache.read(addr & 0xFFFFFFFC);
+  stats.data_cache.read(addr & 0xFFFFFFFC, stats.current_instruction);
   data = DM.read(addr & 0xFFFFFFFC);
   data <<= offset;
   data |= RB[rt] & ((1<<offset)-1);
   RB[rt] = data;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction lwr behavior method.
 void ac_behavior( lwr )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("lwr r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
@@ -659,70 +2708,74 @@ void ac_behavior( lwr )
 
   addr = RB[rs] + imm;
   offset = (3 - (addr & 0x3)) * 8;
-  data_cache.read(addr & 0xFFFFFFFC);
+  stats.data_cache.read(addr & 0xFFFFFFFC, stats.current_instruction);
   data = DM.read(addr & 0xFFFFFFFC);
   data >>= offset;
   data |= RB[rt] & (0xFFFFFFFF << (32-offset));
   RB[rt] = data;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsLoad(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsLoad(rt);
 };
 
 //!Instruction sb behavior method.
 void ac_behavior( sb )
 {
-  check_load_use_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs, rt);
 
   unsigned char byte;
   dbg_printf("sb r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   byte = RB[rt] & 0xFF;
   ac_word addr = RB[rs] + imm;
-  data_cache.write(addr);
+  stats.data_cache.write(addr, stats.current_instruction);
   DM.write_byte(addr, byte);
   dbg_printf("Result = %#x\n", (int) byte);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction sh behavior method.
 void ac_behavior( sh )
 {
-  check_load_use_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs, rt);
 
   unsigned short int half;
   dbg_printf("sh r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   half = RB[rt] & 0xFFFF;
   ac_word addr = RB[rs] + imm;
-  data_cache.write(addr);
+  stats.data_cache.write(addr, stats.current_instruction);
   DM.write_half(addr, half);
   dbg_printf("Result = %#x\n", (int) half);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction sw behavior method.
 void ac_behavior( sw )
 {
-  check_load_use_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs, rt);
 
   dbg_printf("sw r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   ac_word addr = RB[rs] + imm;
-  data_cache.write(addr);
+  stats.data_cache.write(addr, stats.current_instruction);
   DM.write(addr, RB[rt]);
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction swl behavior method.
 void ac_behavior( swl )
 {
-  check_load_use_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs, rt);
 
   dbg_printf("swl r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
@@ -733,18 +2786,19 @@ void ac_behavior( swl )
   data = RB[rt];
   data >>= offset;
   data |= DM.read(addr & 0xFFFFFFFC) & (0xFFFFFFFF << (32-offset));
-  data_cache.write(addr & 0xFFFFFFFC);
+  stats.data_cache.write(addr & 0xFFFFFFFC, stats.current_instruction);
   DM.write(addr & 0xFFFFFFFC, data);
   dbg_printf("Result = %#x\n", data);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction swr behavior method.
 void ac_behavior( swr )
 {
-  check_load_use_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs, rt);
 
   dbg_printf("swr r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
@@ -755,18 +2809,19 @@ void ac_behavior( swr )
   data = RB[rt];
   data <<= offset;
   data |= DM.read(addr & 0xFFFFFFFC) & ((1<<offset)-1);
-  data_cache.write(addr & 0xFFFFFFFC);
+  stats.data_cache.write(addr & 0xFFFFFFFC, stats.current_instruction);
   DM.write(addr & 0xFFFFFFFC, data);
   dbg_printf("Result = %#x\n", data);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction addi behavior method.
 void ac_behavior( addi )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("addi r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   RB[rt] = RB[rs] + imm;
@@ -777,27 +2832,29 @@ void ac_behavior( addi )
     fprintf(stderr, "EXCEPTION(addi): integer overflow.\n"); exit(EXIT_FAILURE);
   }
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction addiu behavior method.
 void ac_behavior( addiu )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("addiu r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   RB[rt] = RB[rs] + imm;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction slti behavior method.
 void ac_behavior( slti )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("slti r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   // Set the RD if RS< IMM
@@ -808,14 +2865,15 @@ void ac_behavior( slti )
     RB[rt] = 0;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction sltiu behavior method.
 void ac_behavior( sltiu )
 {
-  check_load_use_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("sltiu r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   // Set the RD if RS< IMM
@@ -826,53 +2884,57 @@ void ac_behavior( sltiu )
     RB[rt] = 0;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction andi behavior method.
 void ac_behavior( andi )
-{	
-  check_load_use_hazard(rs);
+{
+  ProcessorStats &stats = *current_stats;	
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("andi r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   RB[rt] = RB[rs] & (imm & 0xFFFF) ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction ori behavior method.
 void ac_behavior( ori )
-{	
-  check_load_use_hazard(rs);
+{
+  ProcessorStats &stats = *current_stats;	
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("ori r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   RB[rt] = RB[rs] | (imm & 0xFFFF) ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction xori behavior method.
 void ac_behavior( xori )
-{	
-  check_load_use_hazard(rs);
+{
+  ProcessorStats &stats = *current_stats;	
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("xori r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   RB[rt] = RB[rs] ^ (imm & 0xFFFF) ;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction lui behavior method.
 void ac_behavior( lui )
-{	
-  check_load_use_hazard(rs);
+{
+  ProcessorStats &stats = *current_stats;	
+  stats.checkLoadUseHazard(rs);
 
   dbg_printf("lui r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   // Load a constant in the upper 16 bits of a register
@@ -881,13 +2943,14 @@ void ac_behavior( lui )
   RB[rt] = imm << 16;
   dbg_printf("Result = %#x\n", RB[rt]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rt);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rt);
 };
 
 //!Instruction add behavior method.
 void ac_behavior( add )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("add r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] + RB[rt];
   dbg_printf("Result = %#x\n", RB[rd]);
@@ -897,49 +2960,53 @@ void ac_behavior( add )
     fprintf(stderr, "EXCEPTION(add): integer overflow.\n"); exit(EXIT_FAILURE);
   }
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction addu behavior method.
 void ac_behavior( addu )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("addu r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] + RB[rt];
   //cout << "  RS: " << (unsigned int)RB[rs] << " RT: " << (unsigned int)RB[rt] << endl;
   //cout << "  Result =  " <<  (unsigned int)RB[rd] <<endl;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction sub behavior method.
 void ac_behavior( sub )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("sub r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] - RB[rt];
   dbg_printf("Result = %#x\n", RB[rd]);
   //TODO: test integer overflow exception for sub
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction subu behavior method.
 void ac_behavior( subu )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("subu r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] - RB[rt];
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction slt behavior method.
 void ac_behavior( slt )
-{	
+{
+  ProcessorStats &stats = *current_stats;	
   dbg_printf("slt r%d, r%d, r%d\n", rd, rs, rt);
   // Set the RD if RS< RT
   if( (ac_Sword) RB[rs] < (ac_Sword) RB[rt] )
@@ -949,13 +3016,14 @@ void ac_behavior( slt )
     RB[rd] = 0;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction sltu behavior method.
 void ac_behavior( sltu )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("sltu r%d, r%d, r%d\n", rd, rs, rt);
   // Set the RD if RS < RT
   if( RB[rs] < RB[rt] )
@@ -965,132 +3033,144 @@ void ac_behavior( sltu )
     RB[rd] = 0;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction instr_and behavior method.
 void ac_behavior( instr_and )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("instr_and r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] & RB[rt];
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction instr_or behavior method.
 void ac_behavior( instr_or )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("instr_or r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] | RB[rt];
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction instr_xor behavior method.
 void ac_behavior( instr_xor )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("instr_xor r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = RB[rs] ^ RB[rt];
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction instr_nor behavior method.
 void ac_behavior( instr_nor )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("nor r%d, r%d, r%d\n", rd, rs, rt);
   RB[rd] = ~(RB[rs] | RB[rt]);
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction nop behavior method.
 void ac_behavior( nop )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("nop\n");
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsNop();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsNop();
 };
 
 //!Instruction sll behavior method.
 void ac_behavior( sll )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("sll r%d, r%d, %d\n", rd, rs, shamt);
   RB[rd] = RB[rt] << shamt;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction srl behavior method.
 void ac_behavior( srl )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("srl r%d, r%d, %d\n", rd, rs, shamt);
   RB[rd] = RB[rt] >> shamt;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction sra behavior method.
 void ac_behavior( sra )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("sra r%d, r%d, %d\n", rd, rs, shamt);
   RB[rd] = (ac_Sword) RB[rt] >> shamt;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction sllv behavior method.
 void ac_behavior( sllv )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("sllv r%d, r%d, r%d\n", rd, rt, rs);
   RB[rd] = RB[rt] << (RB[rs] & 0x1F);
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction srlv behavior method.
 void ac_behavior( srlv )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("srlv r%d, r%d, r%d\n", rd, rt, rs);
   RB[rd] = RB[rt] >> (RB[rs] & 0x1F);
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction srav behavior method.
 void ac_behavior( srav )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("srav r%d, r%d, r%d\n", rd, rt, rs);
   RB[rd] = (ac_Sword) RB[rt] >> (RB[rs] & 0x1F);
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction mult behavior method.
 void ac_behavior( mult )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("mult r%d, r%d\n", rs, rt);
 
   long long result;
@@ -1109,13 +3189,14 @@ void ac_behavior( mult )
 
   dbg_printf("Result = %#llx\n", result);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction multu behavior method.
 void ac_behavior( multu )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("multu r%d, r%d\n", rs, rt);
 
   unsigned long long result;
@@ -1134,78 +3215,84 @@ void ac_behavior( multu )
 
   dbg_printf("Result = %#llx\n", result);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction div behavior method.
 void ac_behavior( div )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("div r%d, r%d\n", rs, rt);
   // Register LO receives quotient
   lo = (ac_Sword) RB[rs] / (ac_Sword) RB[rt];
   // Register HI receives remainder
   hi = (ac_Sword) RB[rs] % (ac_Sword) RB[rt];
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction divu behavior method.
 void ac_behavior( divu )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("divu r%d, r%d\n", rs, rt);
   // Register LO receives quotient
   lo = RB[rs] / RB[rt];
   // Register HI receives remainder
   hi = RB[rs] % RB[rt];
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction mfhi behavior method.
 void ac_behavior( mfhi )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("mfhi r%d\n", rd);
   RB[rd] = hi;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction mthi behavior method.
 void ac_behavior( mthi )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("mthi r%d\n", rs);
   hi = RB[rs];
   dbg_printf("Result = %#x\n", (unsigned int)hi);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction mflo behavior method.
 void ac_behavior( mflo )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("mflo r%d\n", rd);
   RB[rd] = lo;
   dbg_printf("Result = %#x\n", RB[rd]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction mtlo behavior method.
 void ac_behavior( mtlo )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("mtlo r%d\n", rs);
   lo = RB[rs];
   dbg_printf("Result = %#x\n", (unsigned int)lo);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction j behavior method.
@@ -1240,6 +3327,7 @@ void ac_behavior( jal )
 //!Instruction jr behavior method.
 void ac_behavior( jr )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("jr r%d\n", rs);
   // Jump to the address stored on the register reg[RS]
   // It must also flush the instructions that were loaded into the pipeline
@@ -1248,13 +3336,14 @@ void ac_behavior( jr )
 #endif
   dbg_printf("Target = %#x\n", RB[rs]);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction jalr behavior method.
 void ac_behavior( jalr )
 {
+  ProcessorStats &stats = *current_stats;
   dbg_printf("jalr r%d, r%d\n", rd, rs);
   // Save the value of PC + 8(return address) in rd and
   // jump to the address given by [rs]
@@ -1269,19 +3358,20 @@ void ac_behavior( jalr )
   RB[rd] = ac_pc+4;
   dbg_printf("Return = %#x\n", ac_pc+4);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsALU(rd);
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsALU(rd);
 };
 
 //!Instruction beq behavior method.
 void ac_behavior( beq )
 {
-  check_branch_data_hazard(rs, rt);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs, rt);
 
   dbg_printf("beq r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   bool taken = RB[rs] == RB[rt];
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1289,19 +3379,20 @@ void ac_behavior( beq )
     dbg_printf("Taken to %#x\n", target);
   }	
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction bne behavior method.
 void ac_behavior( bne )
-{	
-  check_branch_data_hazard(rs, rt);
+{
+  ProcessorStats &stats = *current_stats;	
+  stats.checkBranchDataHazard(rs, rt);
 
   dbg_printf("bne r%d, r%d, %d\n", rt, rs, imm & 0xFFFF);
   bool taken = RB[rs] != RB[rt];
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1309,19 +3400,20 @@ void ac_behavior( bne )
     dbg_printf("Taken to %#x\n", target);
   }	
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction blez behavior method.
 void ac_behavior( blez )
 {
-  check_branch_data_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs);
 
   dbg_printf("blez r%d, %d\n", rs, imm & 0xFFFF);
   bool taken = (RB[rs] == 0) || (RB[rs] & 0x80000000);
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target, 1;
@@ -1329,19 +3421,20 @@ void ac_behavior( blez )
     dbg_printf("Taken to %#x\n", target);
   }	
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction bgtz behavior method.
 void ac_behavior( bgtz )
 {
-  check_branch_data_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs);
 
   dbg_printf("bgtz r%d, %d\n", rs, imm & 0xFFFF);
   bool taken = !(RB[rs] & 0x80000000) && (RB[rs] != 0);
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1349,19 +3442,20 @@ void ac_behavior( bgtz )
     dbg_printf("Taken to %#x\n", target);
   }	
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction bltz behavior method.
 void ac_behavior( bltz )
 {
-  check_branch_data_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs);
 
   dbg_printf("bltz r%d, %d\n", rs, imm & 0xFFFF);
   bool taken = RB[rs] & 0x80000000;
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1369,19 +3463,20 @@ void ac_behavior( bltz )
     dbg_printf("Taken to %#x\n", target);
   }	
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction bgez behavior method.
 void ac_behavior( bgez )
 {
-  check_branch_data_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs);
 
   dbg_printf("bgez r%d, %d\n", rs, imm & 0xFFFF);
   bool taken = !(RB[rs] & 0x80000000);
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1389,20 +3484,21 @@ void ac_behavior( bgez )
     dbg_printf("Taken to %#x\n", target);
   }	
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction bltzal behavior method.
 void ac_behavior( bltzal )
 {
-  check_branch_data_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs);
 
   dbg_printf("bltzal r%d, %d\n", rs, imm & 0xFFFF);
   RB[Ra] = ac_pc+4; //ac_pc is pc+4, we need pc+8
   bool taken = RB[rs] & 0x80000000;
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1411,19 +3507,20 @@ void ac_behavior( bltzal )
   }	
   dbg_printf("Return = %#x\n", ac_pc+4);
 
-  lastInstruction.setIsOther();
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction bgezal behavior method.
 void ac_behavior( bgezal )
 {
-  check_branch_data_hazard(rs);
+  ProcessorStats &stats = *current_stats;
+  stats.checkBranchDataHazard(rs);
 
   dbg_printf("bgezal r%d, %d\n", rs, imm & 0xFFFF);
   RB[Ra] = ac_pc+4; //ac_pc is pc+4, we need pc+8
   bool taken = !(RB[rs] & 0x80000000);
   ac_word target = ac_pc + (imm << 2);
-  prediction_buffer.update(current_instruction, taken, target);
+  stats.prediction_buffer.update(stats.current_instruction, taken, target);
   if (taken) {
 #ifndef NO_NEED_PC_UPDATE
     npc = target;
@@ -1432,15 +3529,16 @@ void ac_behavior( bgezal )
   }	
   dbg_printf("Return = %#x\n", ac_pc+4);
 
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
 };
 
 //!Instruction sys_call behavior method.
 void ac_behavior( sys_call )
 {
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  ProcessorStats &stats = *current_stats;
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
   dbg_printf("syscall\n");
   stop();
 }
@@ -1448,8 +3546,9 @@ void ac_behavior( sys_call )
 //!Instruction instr_break behavior method.
 void ac_behavior( instr_break )
 {
-  lastLastInstruction = lastInstruction;
-  lastInstruction.setIsOther();
+  ProcessorStats &stats = *current_stats;
+  stats.lastLastInstruction = stats.lastInstruction;
+  stats.lastInstruction.setIsOther();
   fprintf(stderr, "instr_break behavior not implemented.\n");
   exit(EXIT_FAILURE);
 }
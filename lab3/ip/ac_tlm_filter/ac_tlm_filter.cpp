@@ -4,34 +4,70 @@
 // ArchC includes
 
 #include "ac_tlm_filter.h"
+#include "ac_tlm_filter_batch.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
-#include <math.h>
+#include <stdio.h>
+#include <vector>
 
 /// Namespace to isolate filter from ArchC
 using user::ac_tlm_filter;
 
 /// Constructor
-ac_tlm_filter::ac_tlm_filter(sc_module_name module_name, int filter_num)
+ac_tlm_filter::ac_tlm_filter(sc_module_name module_name, int num_contexts,
+                             int num_units, int depth, int interval)
   : sc_module(module_name) 
   , target_export("iport")
-  , filter_number(filter_num)
+  , mem_port("mem_port", 5242880U)
+  , num_contexts(num_contexts > 0 ? num_contexts : 1)
+  , num_units(num_units > 0 ? num_units : 1)
+  , pipeline_depth(depth > 0 ? depth : 1)
+  , initiation_interval(interval > 0 ? interval : 1)
+  , cycle(FILTER_CYCLE_NS, SC_NS)
+  , queue_depth(FILTER_QUEUE_DEPTH)
 {
-    int k;
+    int i, k;
 
     /// Binds target_export to the filter
     target_export(*this);
 
-    /// Initialize memory vector
-    memory = new uint8_t[44];
-    for (k = 43; k > 0; k--) memory[k] = 0;
+    /// Initialize the register file of every context
+    contexts = new filter_context[this->num_contexts];
+    for (i = 0; i < this->num_contexts; i++) {
+      filter_context &context = contexts[i];
+      context.memory = new uint8_t[FILTER_ADDRESS_OFFSET];
+      for (k = FILTER_ADDRESS_OFFSET - 1; k >= 0; k--) context.memory[k] = 0;
+      context.blocked_pushes = 0;
+      context.blocked_pops = 0;
+      context.window_columns = 0;
+      context.window_dirty = true;
+      context.window_started = false;
+      context.requests = 0;
+      context.queued_requests = 0;
+    }
+
+    units = new compute_unit[this->num_units];
+    for (i = 0; i < this->num_units; i++) {
+      units[i].operations = 0;
+    }
+
+    /// Default latencies, the square root makes sobel the slowest
+    latency[TYPE_MEAN] = 3;
+    latency[TYPE_SOBEL] = 6;
+    latency[TYPE_SOBEL_FAST] = 3;
+    latency[TYPE_CONVOLUTION] = 4;
+    latency[TYPE_MEDIAN] = 5;
+
+    SC_THREAD(notify_thread);
 }
 
 /// Destructor
 ac_tlm_filter::~ac_tlm_filter()
 {
-  delete [] memory;
+  for (int i = 0; i < num_contexts; i++) delete [] contexts[i].memory;
+  delete [] contexts;
+  delete [] units;
 }
 
 /**
@@ -43,39 +79,214 @@ ac_tlm_filter::~ac_tlm_filter()
  */
 ac_tlm_rsp_status ac_tlm_filter::readm(const uint32_t &a, uint32_t &d)
 {
-  int *result, *type, *tl, *tc, *tr, *ml, *mc, *mr, *bl, *bc, *br;
-  uint32_t index = a - FILTER_ADDRESS - filter_number * FILTER_ADDRESS_OFFSET;
+  uint32_t number = (a - FILTER_ADDRESS) / FILTER_ADDRESS_OFFSET;
+  uint32_t index = (a - FILTER_ADDRESS) % FILTER_ADDRESS_OFFSET;
+
+  if (number >= (uint32_t) num_contexts) return ERROR;
+  filter_context &context = contexts[number];
 
   // Apply filter
   if (index == INDEX_RESULT) {
-    tl = (int *) &memory[INDEX_TL];
-    tc = (int *) &memory[INDEX_TC];
-    tr = (int *) &memory[INDEX_TR];
-    ml = (int *) &memory[INDEX_ML];
-    mc = (int *) &memory[INDEX_MC];
-    mr = (int *) &memory[INDEX_MR];
-    bl = (int *) &memory[INDEX_BL];
-    bc = (int *) &memory[INDEX_BC];
-    br = (int *) &memory[INDEX_BR];
-    type = (int *) &memory[INDEX_TYPE];
-    result = (int *) &memory[INDEX_RESULT];
-
-    if (*type == TYPE_SOBEL) {
-      *result = sobel_filter(*tl, *tc, *tr, *ml, *mc, *mr, *bl, *bc, *br);
-    } else {
-      *result = mean_filter(*tl, *tc, *tr, *ml, *mc, *mr, *bl, *bc, *br);
+    // Reading only starts the filter when the inputs changed since the last
+    // start, so reading RESULT again has no side effect
+    if (context.window_dirty) {
+      if (!window_supported(context)) return ERROR;
+      start_window(context);
+    }
+
+    // The result is only there once it leaves the pipeline
+    if (context.result_ready > sc_time_stamp()) {
+      wait(context.result_ready - sc_time_stamp());
     }
+  } else if (index == INDEX_STATUS) {
+    *((uint32_t *) &context.memory[INDEX_STATUS]) = read_status(context);
+  } else if (index == INDEX_POP) {
+    *((int *) &context.memory[INDEX_POP]) = pop_result(context);
+  } else if (index == INDEX_QSTATUS) {
+    *((uint32_t *) &context.memory[INDEX_QSTATUS]) = context.results.size();
   }
 
-  // Flip endianness
-  ((uint8_t *)&d)[0] = memory[index+3];
-  ((uint8_t *)&d)[1] = memory[index+2];
-  ((uint8_t *)&d)[2] = memory[index+1];
-  ((uint8_t *)&d)[3] = memory[index];
+  // Registers are kept in host byte order, the router converts them
+  d = *((uint32_t *) &context.memory[index]);
 
   return SUCCESS;
 }
 
+/**
+ * Whether the selected filter can be applied to the window registers. They
+ * only hold 3x3 pixels, so convolution and median filters need KSIZE 3; 5x5
+ * kernels are only available in tile mode.
+ */
+bool ac_tlm_filter::window_supported(filter_context &context)
+{
+  int type = *((int *) &context.memory[INDEX_TYPE]);
+  return kernel_size(context, type) == 3;
+}
+
+/**
+ * Apply the selected filter to the window registers, which must be supported.
+ * @returns the filtered pixel
+ */
+int ac_tlm_filter::compute_window(filter_context &context)
+{
+  int tl = *((int *) &context.memory[INDEX_TL]);
+  int tc = *((int *) &context.memory[INDEX_TC]);
+  int tr = *((int *) &context.memory[INDEX_TR]);
+  int ml = *((int *) &context.memory[INDEX_ML]);
+  int mc = *((int *) &context.memory[INDEX_MC]);
+  int mr = *((int *) &context.memory[INDEX_MR]);
+  int bl = *((int *) &context.memory[INDEX_BL]);
+  int bc = *((int *) &context.memory[INDEX_BC]);
+  int br = *((int *) &context.memory[INDEX_BR]);
+  int type = *((int *) &context.memory[INDEX_TYPE]);
+
+  if (type == TYPE_CONVOLUTION || type == TYPE_MEDIAN) {
+    filter_kernel kernel;
+    int window[3][3] = {{tl, tc, tr}, {ml, mc, mr}, {bl, bc, br}};
+    const int *rows[3] = {window[0], window[1], window[2]};
+    int out[3];
+    read_kernel(context, 3, kernel);
+    filter_rows(type, kernel, rows, out, 3);
+    return out[1];
+  } else if (type == TYPE_SOBEL) {
+    return sobel_filter(tl, tc, tr, ml, mc, mr, bl, bc, br);
+  } else if (type == TYPE_SOBEL_FAST) {
+    return sobel_fast_filter(tl, tc, tr, ml, mc, mr, bl, bc, br);
+  }
+  return mean_filter(tl, tc, tr, ml, mc, mr, bl, bc, br);
+}
+
+/**
+ * Start filtering the window registers, latching the result in RESULT. The
+ * result is ready once it leaves the pipeline, at which point done_event is
+ * notified. Only one started window per context is in flight, so starting
+ * another one waits for the previous result.
+ */
+void ac_tlm_filter::start_window(filter_context &context)
+{
+  if (context.result_ready > sc_time_stamp()) {
+    wait(context.result_ready - sc_time_stamp());
+  }
+
+  sc_time now = sc_time_stamp();
+  int type = *((int *) &context.memory[INDEX_TYPE]);
+  *((int *) &context.memory[INDEX_RESULT]) = compute_window(context);
+  context.window_dirty = false;
+  context.window_started = true;
+  context.result_ready = issue(context, type, 1);
+
+  ++context.requests;
+  context.response_time += context.result_ready - now;
+
+  // Completions are kept in order, since an event only holds one of them
+  completions.push(std::make_pair(context.result_ready,
+                                  (int) (&context - contexts)));
+  completion_event.notify(completions.top().first - now);
+}
+
+/**
+ * Status of the last started window.
+ * @returns FILTER_STATUS_BUSY while its result is in the pipeline,
+ *          FILTER_STATUS_DONE once it is ready, 0 if nothing was started
+ */
+uint32_t ac_tlm_filter::read_status(filter_context &context)
+{
+  if (!context.window_started) return 0;
+  if (context.result_ready > sc_time_stamp()) return FILTER_STATUS_BUSY;
+  return FILTER_STATUS_DONE;
+}
+
+/**
+ * Write the result to the NOTIFY address, if any, when a started window
+ * completes. Cores can monitor that address and sleep until the write
+ * instead of polling STATUS. The address must be plain memory, since a
+ * blocking device would stall the filter.
+ */
+void ac_tlm_filter::notify_thread()
+{
+  while (true) {
+    wait(completion_event);
+
+    sc_time now = sc_time_stamp();
+    while (!completions.empty() && completions.top().first <= now) {
+      filter_context &context = contexts[completions.top().second];
+      completions.pop();
+
+      uint32_t address = *((uint32_t *) &context.memory[INDEX_NOTIFY]);
+      int result = *((int *) &context.memory[INDEX_RESULT]);
+      if (address != 0) write_word(address, result);
+      done_event.notify(SC_ZERO_TIME);
+    }
+    if (!completions.empty()) {
+      completion_event.notify(completions.top().first - now);
+    }
+  }
+}
+
+/**
+ * Start filtering the window registers and queue the result, so the core can
+ * write the next window while this one is in the pipeline. The core is
+ * suspended while the result queue is full.
+ */
+void ac_tlm_filter::push_window(filter_context &context)
+{
+  queued_result entry;
+
+  if ((int) context.results.size() >= queue_depth) {
+    ++context.blocked_pushes;
+    while ((int) context.results.size() >= queue_depth) wait(context.popped);
+  }
+
+  entry.value = compute_window(context);
+  entry.pushed = sc_time_stamp();
+  int type = *((int *) &context.memory[INDEX_TYPE]);
+  entry.ready = issue(context, type, 1);
+  context.results.push_back(entry);
+  context.pushed.notify(SC_ZERO_TIME);
+}
+
+/**
+ * Shift the window one pixel to the left, bringing COL_T, COL_M and COL_B in
+ * as its right column. Once the window holds three columns of the current row
+ * it is pushed, so a row of N pixels streams through with three writes per
+ * pixel and yields N-2 results on POP.
+ */
+void ac_tlm_filter::shift_column(filter_context &context)
+{
+  int *window = (int *) &context.memory[INDEX_TL];
+  int *column = (int *) &context.memory[INDEX_COL_T];
+
+  for (int row = 0; row < 3; row++) {
+    window[3 * row] = window[3 * row + 1];
+    window[3 * row + 1] = window[3 * row + 2];
+    window[3 * row + 2] = column[row];
+  }
+
+  if (context.window_columns < 3) context.window_columns++;
+  if (context.window_columns == 3) push_window(context);
+}
+
+/**
+ * Take the oldest pushed result, suspending the core until it is ready.
+ * @returns the filtered pixel
+ */
+int ac_tlm_filter::pop_result(filter_context &context)
+{
+  if (context.results.empty()) {
+    ++context.blocked_pops;
+    while (context.results.empty()) wait(context.pushed);
+  }
+
+  queued_result entry = context.results.front();
+  context.results.pop_front();
+  context.popped.notify(SC_ZERO_TIME);
+
+  ++context.requests;
+  context.response_time += entry.ready - entry.pushed;
+  if (entry.ready > sc_time_stamp()) wait(entry.ready - sc_time_stamp());
+  return entry.value;
+}
+
 /**
  * Write parameter (pixel value) to memory.
  * Note: Always write 32 bits
@@ -85,17 +296,330 @@ ac_tlm_rsp_status ac_tlm_filter::readm(const uint32_t &a, uint32_t &d)
  */
 ac_tlm_rsp_status ac_tlm_filter::writem(const uint32_t &a, const uint32_t &d)
 {
-  uint32_t index = a - FILTER_ADDRESS - filter_number * FILTER_ADDRESS_OFFSET;
+  uint32_t number = (a - FILTER_ADDRESS) / FILTER_ADDRESS_OFFSET;
+  uint32_t index = (a - FILTER_ADDRESS) % FILTER_ADDRESS_OFFSET;
 
-  // Flip endianness
-  memory[index]   = ((uint8_t *) &d)[3];
-  memory[index+1] = ((uint8_t *) &d)[2];
-  memory[index+2] = ((uint8_t *) &d)[1];
-  memory[index+3] = ((uint8_t *) &d)[0];
+  if (number >= (uint32_t) num_contexts) return ERROR;
+  filter_context &context = contexts[number];
+
+  *((uint32_t *) &context.memory[index]) = d;
+
+  // A 5x5 kernel can't be applied to a window
+  if ((index == INDEX_START || index == INDEX_PUSH || index == INDEX_COL_B) &&
+      !window_supported(context)) {
+    return ERROR;
+  }
+
+  // Any input may have changed, except for the control registers
+  if (index != INDEX_START && index != INDEX_NOTIFY) {
+    context.window_dirty = true;
+  }
+
+  // Start filtering the window registers
+  if (index == INDEX_START) {
+    start_window(context);
+  }
+
+  // Queue the current window
+  if (index == INDEX_PUSH) {
+    push_window(context);
+  }
+
+  // A new type starts a new row of shifted columns
+  if (index == INDEX_TYPE) {
+    context.window_columns = 0;
+  }
+
+  // The bottom pixel completes a column
+  if (index == INDEX_COL_B) {
+    shift_column(context);
+  }
+
+  // Filter a whole tile
+  if (index == INDEX_TILE) {
+    uint32_t pixels = filter_tile(context);
+    *((uint32_t *) &context.memory[INDEX_TILE]) = pixels;
+    int type = *((int *) &context.memory[INDEX_TYPE]);
+    if (pixels > 0) complete(context, type, pixels);
+  }
 
   return SUCCESS;
 }
 
+/**
+ * Filter a tile of HEIGHT rows by WIDTH columns of 32-bit pixels starting at
+ * SRC, writing the interior pixels to DST. With an NxN window (3x3, or KSIZE
+ * for convolution and median filters) output row i is computed from input
+ * rows i to i+N-1 and its pixels are written to the matching columns of DST,
+ * so the N/2 border columns are left untouched. Both images are STRIDE bytes
+ * apart between rows. Input rows are fetched only once and kept in N line
+ * buffers while the window slides over them.
+ * @returns the number of pixels produced
+ */
+uint32_t ac_tlm_filter::filter_tile(filter_context &context)
+{
+  uint32_t src = *((uint32_t *) &context.memory[INDEX_SRC]);
+  uint32_t dst = *((uint32_t *) &context.memory[INDEX_DST]);
+  int width = *((int *) &context.memory[INDEX_WIDTH]);
+  int height = *((int *) &context.memory[INDEX_HEIGHT]);
+  uint32_t stride = *((uint32_t *) &context.memory[INDEX_STRIDE]);
+  int type = *((int *) &context.memory[INDEX_TYPE]);
+  int size = kernel_size(context, type);
+  int radius = size / 2;
+  int i, j;
+
+  if (size == 0 || width < size || height < size) return 0;
+
+  filter_kernel kernel;
+  read_kernel(context, size, kernel);
+
+  std::vector<int> lines(size * width);
+  std::vector<int> result(width);
+  int *rows[KERNEL_MAX_SIZE];
+  for (i = 0; i < size; i++) rows[i] = &lines[i * width];
+
+  // Prime all but the last line buffer
+  for (i = 0; i < size - 1; i++) {
+    for (j = 0; j < width; j++) {
+      rows[i][j] = read_word(src + i * stride + 4 * j);
+    }
+  }
+
+  for (i = size - 1; i < height; i++) {
+    for (j = 0; j < width; j++) {
+      rows[size - 1][j] = read_word(src + i * stride + 4 * j);
+    }
+    filter_rows(type, kernel, rows, &result[0], width);
+    for (j = radius; j < width - radius; j++) {
+      write_word(dst + (i - size + 1) * stride + 4 * j, result[j]);
+    }
+
+    // Slide the line buffers down
+    int *oldest = rows[0];
+    for (j = 0; j < size - 1; j++) rows[j] = rows[j + 1];
+    rows[size - 1] = oldest;
+  }
+
+  return (height - size + 1) * (width - size + 1);
+}
+
+/**
+ * Window side used by a filter type.
+ * @param type the filter type (TYPE_*)
+ * @returns 3 or 5, or 0 if KSIZE is not a supported size
+ */
+int ac_tlm_filter::kernel_size(filter_context &context, int type)
+{
+  int size = *((int *) &context.memory[INDEX_KSIZE]);
+
+  if (type != TYPE_CONVOLUTION && type != TYPE_MEDIAN) return 3;
+  if (size == 3 || size == 5) return size;
+  return 0;
+}
+
+/**
+ * Gather the convolution kernel from the coefficient registers.
+ * @param size window side the kernel is applied with
+ * @param kernel will contain the kernel
+ */
+void ac_tlm_filter::read_kernel(filter_context &context, int size,
+                                filter_kernel &kernel)
+{
+  int programmed = *((int *) &context.memory[INDEX_KSIZE]);
+  int *coefs = (int *) &context.memory[INDEX_COEF];
+  int i, j;
+
+  if (programmed != 5) programmed = 3;
+
+  kernel.size = size;
+  kernel.shift = *((int *) &context.memory[INDEX_SHIFT]) & 31;
+  kernel.bias = *((int *) &context.memory[INDEX_BIAS]);
+  for (i = 0; i < size; i++) {
+    for (j = 0; j < size; j++) {
+      kernel.coefs[i * size + j] = coefs[i * programmed + j];
+    }
+  }
+}
+
+/**
+ * Filter one row with the kernel selected by type.
+ * @param type the filter type (TYPE_*)
+ * @param kernel the programmed kernel, used by convolution and median
+ * @param rows kernel.size input rows, top to bottom
+ * @param out output row
+ * @param columns number of pixels in each row
+ */
+void ac_tlm_filter::filter_rows(int type, const filter_kernel &kernel,
+                                const int *const *rows, int *out, int columns)
+{
+  if (type == TYPE_CONVOLUTION) {
+    user::convolve_row(kernel, rows, out, columns);
+  } else if (type == TYPE_MEDIAN) {
+    user::median_row(kernel.size, rows, out, columns);
+  } else {
+    user::filter_row(type, rows[0], rows[1], rows[2], out, columns);
+  }
+}
+
+void ac_tlm_filter::set_latency(int type, int cycles)
+{
+  if (type < 0 || type >= FILTER_NUM_TYPES || cycles < 1) return;
+  latency[type] = cycles;
+}
+
+void ac_tlm_filter::set_queue_depth(int depth)
+{
+  if (depth < 1) return;
+  queue_depth = depth;
+}
+
+/**
+ * Schedule operations on the compute units. Each operation goes to the unit
+ * where it can start first: a unit takes an operation INTERVAL cycles after
+ * the previous one, and only once fewer than DEPTH operations are in flight.
+ * @param context the context the operations come from
+ * @param type the filter type, which sets the latency
+ * @param count number of operations, one per output pixel
+ * @returns the time the result of the last operation is ready
+ */
+sc_time ac_tlm_filter::issue(filter_context &context, int type,
+                             uint64_t count)
+{
+  sc_time now = sc_time_stamp();
+  sc_time interval = initiation_interval * cycle;
+  // Unknown types run the mean filter
+  if (type < 0 || type >= FILTER_NUM_TYPES) type = TYPE_MEAN;
+  sc_time duration = latency[type] * cycle;
+  sc_time ready = now;
+
+  for (uint64_t k = 0; k < count; k++) {
+    compute_unit *unit = 0;
+    sc_time start;
+
+    for (int u = 0; u < num_units; u++) {
+      compute_unit &candidate = units[u];
+      sc_time earliest = candidate.next_issue > now ? candidate.next_issue
+                                                    : now;
+
+      // Retire what has finished, then wait for a free stage
+      while (!candidate.in_flight.empty() &&
+             candidate.in_flight.top() <= earliest) {
+        candidate.in_flight.pop();
+      }
+      if ((int) candidate.in_flight.size() >= pipeline_depth) {
+        earliest = candidate.in_flight.top();
+      }
+
+      if (unit == 0 || earliest < start) {
+        unit = &candidate;
+        start = earliest;
+      }
+    }
+
+    if ((int) unit->in_flight.size() >= pipeline_depth) unit->in_flight.pop();
+
+    if (k == 0 && start > now) {
+      ++context.queued_requests;
+      context.queue_time += start - now;
+      if (start - now > context.max_queue_time) {
+        context.max_queue_time = start - now;
+      }
+    }
+
+    unit->in_flight.push(start + duration);
+    unit->next_issue = start + interval;
+    unit->busy_time += interval;
+    ++unit->operations;
+    if (start + duration > ready) ready = start + duration;
+  }
+
+  return ready;
+}
+
+/**
+ * Run operations through the pipeline, suspending the requesting core until
+ * the last result is ready.
+ * @param type the filter type
+ * @param count number of operations
+ */
+void ac_tlm_filter::complete(filter_context &context, int type,
+                             uint64_t count)
+{
+  sc_time now = sc_time_stamp();
+  sc_time ready = issue(context, type, count);
+
+  ++context.requests;
+  context.response_time += ready - now;
+  if (ready > now) wait(ready - now);
+}
+
+void ac_tlm_filter::print_stats()
+{
+  double elapsed = sc_time_stamp() / sc_time(1, SC_NS);
+
+  for (int i = 0; i < num_units; i++) {
+    compute_unit &unit = units[i];
+    double busy = unit.busy_time / sc_time(1, SC_NS);
+    fprintf(stderr, "Filter unit %d: %llu operations, utilisation %.1lf%%\n",
+            i, (unsigned long long)unit.operations,
+            elapsed > 0.0 ? 100.0 * busy / elapsed : 0.0);
+  }
+
+  for (int i = 0; i < num_contexts; i++) {
+    filter_context &context = contexts[i];
+    if (context.requests == 0) continue;
+
+    fprintf(stderr, "Filter context %d: %llu requests, "
+            "%llu queued (mean %.1lf ns, max %.1lf ns), "
+            "mean response %.1lf ns, %llu blocked pushes, %llu blocked pops\n",
+            i, (unsigned long long)context.requests,
+            (unsigned long long)context.queued_requests,
+            context.queued_requests
+              ? context.queue_time / sc_time(1, SC_NS) / context.queued_requests
+              : 0.0,
+            context.max_queue_time / sc_time(1, SC_NS),
+            context.response_time / sc_time(1, SC_NS) / context.requests,
+            (unsigned long long)context.blocked_pushes,
+            (unsigned long long)context.blocked_pops);
+  }
+}
+
+/**
+ * Read a word from memory through the master port.
+ * @param a is the address to read
+ * @returns the word in host byte order
+ */
+int ac_tlm_filter::read_word(uint32_t a)
+{
+  ac_tlm_req request;
+  ac_tlm_rsp response;
+
+  request.type = READ;
+  request.dev_id = -1;
+  request.addr = a;
+  request.data = 0;
+  response = mem_port->transport(request);
+
+  // Memory is kept in target (big endian) byte order
+  return (int) __builtin_bswap32(response.data);
+}
+
+/**
+ * Write a word to memory through the master port.
+ * @param a is the address to write
+ * @param d is the word in host byte order
+ */
+void ac_tlm_filter::write_word(uint32_t a, int d)
+{
+  ac_tlm_req request;
+
+  request.type = WRITE;
+  request.dev_id = -1;
+  request.addr = a;
+  request.data = __builtin_bswap32((uint32_t) d);
+  mem_port->transport(request);
+}
+
 /**
  * Apply the mean filter on a 3x3 window.
  * @param t_ top pixel
@@ -123,22 +647,57 @@ int ac_tlm_filter::mean_filter(int tl, int tc, int tr,
 int ac_tlm_filter::sobel_filter(int tl, int tc, int tr,
                                 int ml, int mc, int mr,
                                 int bl, int bc, int br) {
-  double sum, sum_x = 0.0, sum_y = 0.0;
+  int64_t sum_x, sum_y;
 
   // Horizontal component
-  sum_x += 1.0 * tl + 0.0 * tc - 1.0 * tr;
-  sum_x += 2.0 * ml + 0.0 * mc - 2.0 * mr;
-  sum_x += 1.0 * bl + 0.0 * bc - 1.0 * br;
+  sum_x = (int64_t) tl - tr + 2 * ((int64_t) ml - mr) + ((int64_t) bl - br);
 
   // Vertical component
-  sum_y +=  1.0 * tl + 2.0 * tc + 1.0 * tr;
-  sum_y +=  0.0 * ml + 0.0 * mc + 0.0 * mr;
-  sum_y += -1.0 * bl - 2.0 * bc - 1.0 * br;
+  sum_y = (int64_t) tl + 2 * (int64_t) tc + tr
+        - ((int64_t) bl + 2 * (int64_t) bc + br);
+
+  // The magnitude saturates as soon as it reaches 256
+  if (sum_x <= -256 || sum_x >= 256 || sum_y <= -256 || sum_y >= 256) {
+    return 255;
+  }
+  uint32_t sum = (uint32_t) (sum_x * sum_x + sum_y * sum_y);
+  if (sum >= 256 * 256) return 255;
+
+  // Integer square root, one result bit per iteration
+  uint32_t root = 0, bit = 1 << 14;
+  while (bit > sum) bit >>= 2;
+  while (bit != 0) {
+    if (sum >= root + bit) {
+      sum -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (int) root;
+}
+
+/**
+ * Apply the sobel filter on a 3x3 window, approximating the gradient
+ * magnitude by |gx| + |gy|. Cheaper than sobel_filter, but not bit-exact.
+ * @param t_ top pixel
+ * @param m_ midle pixel
+ * @param b_ bottom pixel
+ * @param _l left pixel
+ * @param _c center pixel
+ * @param _r right pixel
+ */
+int ac_tlm_filter::sobel_fast_filter(int tl, int tc, int tr,
+                                     int ml, int mc, int mr,
+                                     int bl, int bc, int br) {
+  int64_t sum_x, sum_y, sum;
 
-  // Combine both
-  sum = sqrt(sum_x * sum_x + sum_y * sum_y);
+  sum_x = (int64_t) tl - tr + 2 * ((int64_t) ml - mr) + ((int64_t) bl - br);
+  sum_y = (int64_t) tl + 2 * (int64_t) tc + tr
+        - ((int64_t) bl + 2 * (int64_t) bc + br);
 
-  if (sum < 0.0) return 0;
-  if (sum > 255.0) return 255;
-  return (int)sum;
+  sum = (sum_x < 0 ? -sum_x : sum_x) + (sum_y < 0 ? -sum_y : sum_y);
+  if (sum > 255) return 255;
+  return (int) sum;
 }
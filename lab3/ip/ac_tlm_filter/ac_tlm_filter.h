@@ -6,10 +6,16 @@
 //////////////////////////////////////////////////////////////////////////////
 
 // Standard includes
+#include <deque>
+#include <queue>
+#include <vector>
 // SystemC includes
 #include <systemc>
 // ArchC includes
+#include "ac_tlm_port.H"
 #include "ac_tlm_protocol.H"
+// Filter includes
+#include "ac_tlm_filter_kernel.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -19,7 +25,7 @@ using tlm::tlm_transport_if;
 //////////////////////////////////////////////////////////////////////////////
 
 #define FILTER_ADDRESS  0x700000
-#define FILTER_ADDRESS_OFFSET 44
+#define FILTER_ADDRESS_OFFSET 0x100
 #define INDEX_TL 0x00
 #define INDEX_TC 0x04
 #define INDEX_TR 0x08
@@ -31,9 +37,40 @@ using tlm::tlm_transport_if;
 #define INDEX_BR 0x20
 #define INDEX_TYPE 0x24
 #define INDEX_RESULT 0x28
+#define INDEX_SRC 0x2C
+#define INDEX_DST 0x30
+#define INDEX_WIDTH 0x34
+#define INDEX_HEIGHT 0x38
+#define INDEX_STRIDE 0x3C
+#define INDEX_TILE 0x40
+#define INDEX_KSIZE 0x44 // 3, or 5 in tile mode only
+#define INDEX_SHIFT 0x48
+#define INDEX_BIAS 0x4C
+#define INDEX_COEF 0x50 // KSIZE x KSIZE words, row major, up to 0xB0
+#define INDEX_PUSH 0xB4
+#define INDEX_POP 0xB8
+#define INDEX_QSTATUS 0xBC
+#define INDEX_COL_T 0xC0
+#define INDEX_COL_M 0xC4
+#define INDEX_COL_B 0xC8
+#define INDEX_START 0xCC
+#define INDEX_STATUS 0xD0
+#define INDEX_NOTIFY 0xD4
 
 #define TYPE_MEAN  0
 #define TYPE_SOBEL 1
+#define TYPE_SOBEL_FAST 2
+#define TYPE_CONVOLUTION 3
+#define TYPE_MEDIAN 4
+#define FILTER_NUM_TYPES 5
+
+#define FILTER_CYCLE_NS 10
+#define FILTER_PIPELINE_DEPTH 4
+#define FILTER_INITIATION_INTERVAL 1
+#define FILTER_QUEUE_DEPTH 4
+
+#define FILTER_STATUS_BUSY 1
+#define FILTER_STATUS_DONE 2
 
 //#define DEBUG
 
@@ -49,6 +86,12 @@ class ac_tlm_filter :
 public:
   /// Exposed port with ArchC interface
   sc_export<ac_tlm_transport_if> target_export;
+  /// Port used to fetch and store whole tiles in memory
+  ac_tlm_port mem_port;
+  /// Notified when the result of a window started on any context is ready
+  sc_event done_event;
+
+  SC_HAS_PROCESS(ac_tlm_filter);
 
   /**
    * Implementation of TLM transport method that handle packets of the protocol
@@ -76,21 +119,124 @@ public:
 
   /**
    * Default constructor.
+   *
+   * @param num_contexts number of register contexts, FILTER_ADDRESS_OFFSET
+   *                     bytes apart from FILTER_ADDRESS
+   * @param num_units number of compute units shared by the contexts
+   * @param depth number of operations each unit holds at once
+   * @param interval cycles between the start of two operations on a unit
    */
-  ac_tlm_filter(sc_module_name module_name, int filter_num);
+  ac_tlm_filter(sc_module_name module_name, int num_contexts, int num_units,
+                int depth = FILTER_PIPELINE_DEPTH,
+                int interval = FILTER_INITIATION_INTERVAL);
 
   /**
    * Default destructor.
    */
   ~ac_tlm_filter();
 
+  /// Scalar kernels, one output pixel from a 3x3 window
+  static int mean_filter(int, int, int, int, int, int, int, int, int);
+  static int sobel_filter(int, int, int, int, int, int, int, int, int);
+  static int sobel_fast_filter(int, int, int, int, int, int, int, int, int);
+
+  /**
+   * Set the number of cycles an operation of a given type takes from entering
+   * the pipeline until its result is ready.
+   */
+  void set_latency(int type, int cycles);
+
+  /**
+   * Set how many pushed windows a context may hold before they are popped.
+   */
+  void set_queue_depth(int depth);
+
+  /**
+   * Print utilisation of the compute units and queueing statistics of the
+   * contexts that were used.
+   */
+  void print_stats();
+
 private:
-  uint8_t *memory;
-  int filter_number;
+  /// A pushed window on its way through the pipeline
+  struct queued_result {
+    int value;
+    sc_time pushed;
+    sc_time ready;
+  };
+
+  /// The registers and state a core programs
+  struct filter_context {
+    uint8_t *memory;
+
+    /// Results of pushed windows, oldest first
+    std::deque<queued_result> results;
+    sc_event pushed;
+    sc_event popped;
+    uint64_t blocked_pushes;
+    uint64_t blocked_pops;
+    /// Columns shifted into the window since the row started
+    int window_columns;
+
+    /// RESULT holds the filtered window registers unless they were written
+    bool window_dirty;
+    bool window_started;
+    sc_time result_ready;
+
+    uint64_t requests;
+    uint64_t queued_requests;
+    sc_time queue_time;
+    sc_time max_queue_time;
+    sc_time response_time;
+  };
+
+  /// A pipelined datapath shared by all contexts
+  struct compute_unit {
+    sc_time next_issue;
+    /// Completion times of the operations still in the pipeline
+    std::priority_queue<sc_time, std::vector<sc_time>,
+                        std::greater<sc_time> > in_flight;
+
+    uint64_t operations;
+    sc_time busy_time;
+  };
+
+  filter_context *contexts;
+  int num_contexts;
+  compute_unit *units;
+  int num_units;
+
+  /// Timing model
+  int pipeline_depth;
+  int initiation_interval;
+  int latency[FILTER_NUM_TYPES];
+  sc_time cycle;
+  int queue_depth;
+
+  /// Started windows by completion time, with their context
+  std::priority_queue<std::pair<sc_time, int>,
+                      std::vector<std::pair<sc_time, int> >,
+                      std::greater<std::pair<sc_time, int> > > completions;
+  sc_event completion_event;
+
   ac_tlm_rsp_status readm(const uint32_t &, uint32_t &);
   ac_tlm_rsp_status writem(const uint32_t &, const uint32_t &);
-  int mean_filter(int, int, int, int, int, int, int, int, int);
-  int sobel_filter(int, int, int, int, int, int, int, int, int);
+  uint32_t filter_tile(filter_context &);
+  int kernel_size(filter_context &, int);
+  void read_kernel(filter_context &, int, filter_kernel &);
+  void filter_rows(int, const filter_kernel &, const int *const *, int *, int);
+  sc_time issue(filter_context &, int, uint64_t);
+  void complete(filter_context &, int, uint64_t);
+  bool window_supported(filter_context &);
+  int compute_window(filter_context &);
+  void start_window(filter_context &);
+  uint32_t read_status(filter_context &);
+  void notify_thread();
+  void push_window(filter_context &);
+  void shift_column(filter_context &);
+  int pop_result(filter_context &);
+  int read_word(uint32_t);
+  void write_word(uint32_t, int);
 };
 
 };
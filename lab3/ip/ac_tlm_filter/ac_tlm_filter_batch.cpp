@@ -0,0 +1,224 @@
+//////////////////////////////////////////////////////////////////////////////
+// Standard includes
+// SystemC includes
+// ArchC includes
+
+#include "ac_tlm_filter_batch.h"
+#include "ac_tlm_filter.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FILTER_BATCH_X86
+#include <immintrin.h>
+#endif
+
+/// Namespace to isolate filter from ArchC
+using user::ac_tlm_filter;
+
+/*
+ * The vector kernels work on 32-bit lanes and convert the gradients to float
+ * after saturating them at 256, which keeps every intermediate value exact.
+ * That holds as long as pixels are below 2^16 in magnitude, so rows with
+ * larger values go through the scalar kernels.
+ */
+#define FILTER_BATCH_LIMIT (1 << 16)
+
+typedef void (*row_kernel)(int, const int *, const int *, const int *,
+                           int *, int);
+
+/**
+ * Compute output pixels first to last-1 of a row with the scalar kernels.
+ */
+static void filter_span_scalar(int type, const int *t, const int *m,
+                               const int *b, int *out, int first, int last)
+{
+  for (int c = first; c < last; c++) {
+    if (type == TYPE_SOBEL) {
+      out[c] = ac_tlm_filter::sobel_filter(t[c-1], t[c], t[c+1],
+                                           m[c-1], m[c], m[c+1],
+                                           b[c-1], b[c], b[c+1]);
+    } else if (type == TYPE_SOBEL_FAST) {
+      out[c] = ac_tlm_filter::sobel_fast_filter(t[c-1], t[c], t[c+1],
+                                                m[c-1], m[c], m[c+1],
+                                                b[c-1], b[c], b[c+1]);
+    } else {
+      out[c] = ac_tlm_filter::mean_filter(t[c-1], t[c], t[c+1],
+                                          m[c-1], m[c], m[c+1],
+                                          b[c-1], b[c], b[c+1]);
+    }
+  }
+}
+
+static void filter_row_scalar(int type, const int *t, const int *m,
+                              const int *b, int *out, int columns)
+{
+  filter_span_scalar(type, t, m, b, out, 1, columns - 1);
+}
+
+/**
+ * Whether every pixel of the three rows is small enough for the vector
+ * kernels.
+ */
+static bool fits_vector_kernel(const int *t, const int *m, const int *b,
+                               int columns)
+{
+  uint32_t out_of_range = 0;
+  for (int c = 0; c < columns; c++) {
+    // Added as unsigned, so negative pixels wrap around instead of
+    // overflowing
+    out_of_range |= (uint32_t) t[c] + FILTER_BATCH_LIMIT;
+    out_of_range |= (uint32_t) m[c] + FILTER_BATCH_LIMIT;
+    out_of_range |= (uint32_t) b[c] + FILTER_BATCH_LIMIT;
+  }
+  return out_of_range < 2 * FILTER_BATCH_LIMIT;
+}
+
+#ifdef FILTER_BATCH_X86
+
+static void filter_row_sse2(int type, const int *t, const int *m,
+                            const int *b, int *out, int columns)
+{
+  int c = 1;
+
+  if ((type == TYPE_MEAN || type == TYPE_SOBEL || type == TYPE_SOBEL_FAST) &&
+      fits_vector_kernel(t, m, b, columns)) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 sat = _mm_set1_ps(256.0f);
+    const __m128 max_sum = _mm_set1_ps(65536.0f);
+    const __m128 max_pixel = _mm_set1_ps(255.0f);
+    const __m128 nine = _mm_set1_ps(9.0f);
+
+    for (; c + 4 <= columns - 1; c += 4) {
+      __m128i tl = _mm_loadu_si128((const __m128i *) &t[c-1]);
+      __m128i tc = _mm_loadu_si128((const __m128i *) &t[c]);
+      __m128i tr = _mm_loadu_si128((const __m128i *) &t[c+1]);
+      __m128i ml = _mm_loadu_si128((const __m128i *) &m[c-1]);
+      __m128i mc = _mm_loadu_si128((const __m128i *) &m[c]);
+      __m128i mr = _mm_loadu_si128((const __m128i *) &m[c+1]);
+      __m128i bl = _mm_loadu_si128((const __m128i *) &b[c-1]);
+      __m128i bc = _mm_loadu_si128((const __m128i *) &b[c]);
+      __m128i br = _mm_loadu_si128((const __m128i *) &b[c+1]);
+      __m128 result;
+
+      if (type == TYPE_MEAN) {
+        __m128i sum = _mm_add_epi32(_mm_add_epi32(tl, tc), tr);
+        sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_add_epi32(ml, mc), mr));
+        sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_add_epi32(bl, bc), br));
+        result = _mm_div_ps(_mm_cvtepi32_ps(sum), nine);
+      } else {
+        __m128i gx = _mm_add_epi32(_mm_sub_epi32(tl, tr),
+                                   _mm_sub_epi32(bl, br));
+        gx = _mm_add_epi32(gx, _mm_slli_epi32(_mm_sub_epi32(ml, mr), 1));
+        __m128i gy = _mm_sub_epi32(_mm_add_epi32(tl, tr),
+                                   _mm_add_epi32(bl, br));
+        gy = _mm_add_epi32(gy, _mm_slli_epi32(_mm_sub_epi32(tc, bc), 1));
+
+        __m128 fx = _mm_andnot_ps(sign, _mm_cvtepi32_ps(gx));
+        __m128 fy = _mm_andnot_ps(sign, _mm_cvtepi32_ps(gy));
+        if (type == TYPE_SOBEL) {
+          fx = _mm_min_ps(fx, sat);
+          fy = _mm_min_ps(fy, sat);
+          __m128 sum = _mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy));
+          result = _mm_sqrt_ps(_mm_min_ps(sum, max_sum));
+        } else {
+          result = _mm_add_ps(fx, fy);
+        }
+        result = _mm_min_ps(result, max_pixel);
+      }
+
+      _mm_storeu_si128((__m128i *) &out[c], _mm_cvttps_epi32(result));
+    }
+  }
+
+  filter_span_scalar(type, t, m, b, out, c, columns - 1);
+}
+
+__attribute__((target("avx2")))
+static void filter_row_avx2(int type, const int *t, const int *m,
+                            const int *b, int *out, int columns)
+{
+  int c = 1;
+
+  if ((type == TYPE_MEAN || type == TYPE_SOBEL || type == TYPE_SOBEL_FAST) &&
+      fits_vector_kernel(t, m, b, columns)) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 sat = _mm256_set1_ps(256.0f);
+    const __m256 max_sum = _mm256_set1_ps(65536.0f);
+    const __m256 max_pixel = _mm256_set1_ps(255.0f);
+    const __m256 nine = _mm256_set1_ps(9.0f);
+
+    for (; c + 8 <= columns - 1; c += 8) {
+      __m256i tl = _mm256_loadu_si256((const __m256i *) &t[c-1]);
+      __m256i tc = _mm256_loadu_si256((const __m256i *) &t[c]);
+      __m256i tr = _mm256_loadu_si256((const __m256i *) &t[c+1]);
+      __m256i ml = _mm256_loadu_si256((const __m256i *) &m[c-1]);
+      __m256i mc = _mm256_loadu_si256((const __m256i *) &m[c]);
+      __m256i mr = _mm256_loadu_si256((const __m256i *) &m[c+1]);
+      __m256i bl = _mm256_loadu_si256((const __m256i *) &b[c-1]);
+      __m256i bc = _mm256_loadu_si256((const __m256i *) &b[c]);
+      __m256i br = _mm256_loadu_si256((const __m256i *) &b[c+1]);
+      __m256 result;
+
+      if (type == TYPE_MEAN) {
+        __m256i sum = _mm256_add_epi32(_mm256_add_epi32(tl, tc), tr);
+        sum = _mm256_add_epi32(sum,
+                               _mm256_add_epi32(_mm256_add_epi32(ml, mc), mr));
+        sum = _mm256_add_epi32(sum,
+                               _mm256_add_epi32(_mm256_add_epi32(bl, bc), br));
+        result = _mm256_div_ps(_mm256_cvtepi32_ps(sum), nine);
+      } else {
+        __m256i gx = _mm256_add_epi32(_mm256_sub_epi32(tl, tr),
+                                      _mm256_sub_epi32(bl, br));
+        gx = _mm256_add_epi32(gx,
+                              _mm256_slli_epi32(_mm256_sub_epi32(ml, mr), 1));
+        __m256i gy = _mm256_sub_epi32(_mm256_add_epi32(tl, tr),
+                                      _mm256_add_epi32(bl, br));
+        gy = _mm256_add_epi32(gy,
+                              _mm256_slli_epi32(_mm256_sub_epi32(tc, bc), 1));
+
+        __m256 fx = _mm256_andnot_ps(sign, _mm256_cvtepi32_ps(gx));
+        __m256 fy = _mm256_andnot_ps(sign, _mm256_cvtepi32_ps(gy));
+        if (type == TYPE_SOBEL) {
+          fx = _mm256_min_ps(fx, sat);
+          fy = _mm256_min_ps(fy, sat);
+          __m256 sum = _mm256_add_ps(_mm256_mul_ps(fx, fx),
+                                     _mm256_mul_ps(fy, fy));
+          result = _mm256_sqrt_ps(_mm256_min_ps(sum, max_sum));
+        } else {
+          result = _mm256_add_ps(fx, fy);
+        }
+        result = _mm256_min_ps(result, max_pixel);
+      }
+
+      _mm256_storeu_si256((__m256i *) &out[c], _mm256_cvttps_epi32(result));
+    }
+  }
+
+  filter_span_scalar(type, t, m, b, out, c, columns - 1);
+}
+
+#endif
+
+/**
+ * Pick the widest kernel the host supports, once.
+ */
+static row_kernel select_kernel()
+{
+#ifdef FILTER_BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return filter_row_avx2;
+  return filter_row_sse2;
+#else
+  return filter_row_scalar;
+#endif
+}
+
+static const row_kernel kernel = select_kernel();
+
+void user::filter_row(int type, const int *t, const int *m, const int *b,
+                      int *out, int columns)
+{
+  if (columns < 3) return;
+  kernel(type, t, m, b, out, columns);
+}
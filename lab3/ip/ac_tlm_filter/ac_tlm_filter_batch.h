@@ -0,0 +1,36 @@
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef AC_TLM_FILTER_BATCH_H_
+#define AC_TLM_FILTER_BATCH_H_
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+/// Namespace to isolate filter from ArchC
+namespace user
+{
+
+/**
+ * Apply a 3x3 filter to one row of an image on the host. Output pixels 1 to
+ * columns-2 are computed from the rows above (t), at (m) and below (b); the
+ * border pixels of out are left untouched. The result is the same as calling
+ * the ac_tlm_filter scalar kernels pixel by pixel, but SSE2 or AVX2 is used
+ * when the host supports it.
+ *
+ * @param type the filter type (TYPE_*)
+ * @param t top input row
+ * @param m middle input row
+ * @param b bottom input row
+ * @param out output row
+ * @param columns number of pixels in each row
+ */
+void filter_row(int type, const int *t, const int *m, const int *b,
+                int *out, int columns);
+
+};
+
+#endif //AC_TLM_FILTER_BATCH_H_
@@ -0,0 +1,109 @@
+//////////////////////////////////////////////////////////////////////////////
+// Standard includes
+// SystemC includes
+// ArchC includes
+
+#include "ac_tlm_filter_kernel.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+
+using user::filter_kernel;
+
+/**
+ * Clamp a filtered value to a pixel.
+ */
+static inline int clamp_pixel(int64_t value)
+{
+  if (value < 0) return 0;
+  if (value > 255) return 255;
+  return (int) value;
+}
+
+/**
+ * A 3x3 kernel with its coefficients and shift known at compile time, so zero
+ * coefficients vanish and the rest become shifts and adds.
+ */
+template <int K0, int K1, int K2, int K3, int K4, int K5, int K6, int K7,
+          int K8, int SHIFT>
+struct fixed_kernel3x3
+{
+  static bool matches(const filter_kernel &kernel) {
+    static const int coefs[9] = {K0, K1, K2, K3, K4, K5, K6, K7, K8};
+
+    if (kernel.size != 3 || kernel.shift != SHIFT) return false;
+    for (int k = 0; k < 9; k++) {
+      if (kernel.coefs[k] != coefs[k]) return false;
+    }
+    return true;
+  }
+
+  static void apply(int bias, const int *const *rows, int *out, int columns) {
+    const int *t = rows[0], *m = rows[1], *b = rows[2];
+
+    for (int c = 1; c < columns - 1; c++) {
+      int64_t sum = K0 * (int64_t) t[c-1] + K1 * (int64_t) t[c]
+                  + K2 * (int64_t) t[c+1] + K3 * (int64_t) m[c-1]
+                  + K4 * (int64_t) m[c] + K5 * (int64_t) m[c+1]
+                  + K6 * (int64_t) b[c-1] + K7 * (int64_t) b[c]
+                  + K8 * (int64_t) b[c+1];
+      out[c] = clamp_pixel((sum >> SHIFT) + bias);
+    }
+  }
+};
+
+typedef fixed_kernel3x3<1, 2, 1, 2, 4, 2, 1, 2, 1, 4> gaussian3x3;
+typedef fixed_kernel3x3<0, 1, 0, 1, -4, 1, 0, 1, 0, 0> laplacian3x3;
+typedef fixed_kernel3x3<0, -1, 0, -1, 5, -1, 0, -1, 0, 0> sharpen3x3;
+
+/**
+ * Convolve a row with coefficients read at run time.
+ */
+static void convolve_row_generic(const filter_kernel &kernel,
+                                 const int *const *rows, int *out, int columns)
+{
+  int size = kernel.size, radius = size / 2;
+
+  for (int c = radius; c < columns - radius; c++) {
+    int64_t sum = 0;
+    for (int i = 0; i < size; i++) {
+      const int *row = rows[i] + c - radius;
+      const int *coefs = kernel.coefs + i * size;
+      for (int j = 0; j < size; j++) sum += coefs[j] * (int64_t) row[j];
+    }
+    out[c] = clamp_pixel((sum >> kernel.shift) + kernel.bias);
+  }
+}
+
+void user::convolve_row(const filter_kernel &kernel, const int *const *rows,
+                        int *out, int columns)
+{
+  if (columns < kernel.size) return;
+
+  if (gaussian3x3::matches(kernel)) {
+    gaussian3x3::apply(kernel.bias, rows, out, columns);
+  } else if (laplacian3x3::matches(kernel)) {
+    laplacian3x3::apply(kernel.bias, rows, out, columns);
+  } else if (sharpen3x3::matches(kernel)) {
+    sharpen3x3::apply(kernel.bias, rows, out, columns);
+  } else {
+    convolve_row_generic(kernel, rows, out, columns);
+  }
+}
+
+void user::median_row(int size, const int *const *rows, int *out, int columns)
+{
+  int window[KERNEL_MAX_SIZE * KERNEL_MAX_SIZE];
+  int radius = size / 2, n = size * size;
+
+  for (int c = radius; c < columns - radius; c++) {
+    for (int i = 0; i < size; i++) {
+      for (int j = 0; j < size; j++) {
+        window[i * size + j] = rows[i][c - radius + j];
+      }
+    }
+    std::nth_element(window, window + n / 2, window + n);
+    out[c] = window[n / 2];
+  }
+}
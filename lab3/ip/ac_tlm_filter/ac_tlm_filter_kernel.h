@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef AC_TLM_FILTER_KERNEL_H_
+#define AC_TLM_FILTER_KERNEL_H_
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+#define KERNEL_MAX_SIZE 5
+
+/// Namespace to isolate filter from ArchC
+namespace user
+{
+
+/**
+ * A convolution kernel as programmed through the filter registers. Output
+ * pixels are (sum of coefs * window >> shift) + bias, clamped to [0, 255].
+ * The shift rounds towards minus infinity.
+ */
+struct filter_kernel {
+  /// Window side, 3 or 5
+  int size;
+  int shift;
+  int bias;
+  /// size x size coefficients in row major order
+  int coefs[KERNEL_MAX_SIZE * KERNEL_MAX_SIZE];
+};
+
+/**
+ * Convolve one row of an image. rows holds kernel.size input rows, top to
+ * bottom; output pixels size/2 to columns-1-size/2 are written to out and the
+ * border pixels are left untouched. The common 3x3 kernels (Gaussian,
+ * Laplacian and sharpen) are recognized and run with their coefficients known
+ * at compile time.
+ *
+ * @param kernel the kernel to apply
+ * @param rows the input rows
+ * @param out output row
+ * @param columns number of pixels in each row
+ */
+void convolve_row(const filter_kernel &kernel, const int *const *rows,
+                  int *out, int columns);
+
+/**
+ * Apply a median filter to one row of an image, with the same layout as
+ * convolve_row.
+ *
+ * @param size window side, 3 or 5
+ * @param rows the input rows
+ * @param out output row
+ * @param columns number of pixels in each row
+ */
+void median_row(int size, const int *const *rows, int *out, int columns);
+
+};
+
+#endif //AC_TLM_FILTER_KERNEL_H_
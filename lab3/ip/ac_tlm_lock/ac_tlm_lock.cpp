@@ -7,21 +7,44 @@
 
 //////////////////////////////////////////////////////////////////////////////
 
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
 /// Namespace to isolate lock from ArchC
 using user::ac_tlm_lock;
 
 /// Constructor
-ac_tlm_lock::ac_tlm_lock(sc_module_name module_name)
+ac_tlm_lock::ac_tlm_lock(sc_module_name module_name, int num_cores)
   : sc_module(module_name)
   , target_export("iport")
   , lock(0)
+  , next_ticket(0)
+  , now_serving(0)
+  , cores(new ticket_stats[num_cores])
+  , num_cores(num_cores)
 {
     /// Binds target_export to the lock
     target_export(*this);
+
+    for (int i = 0; i < num_cores; i++) {
+      cores[i].waiting = false;
+      cores[i].ticket = 0;
+      cores[i].acquisitions = 0;
+      cores[i].polls = 0;
+      cores[i].total_wait = 0.0;
+      cores[i].max_wait = 0.0;
+      for (int j = 0; j < LOCK_HISTOGRAM_BUCKETS; j++) {
+        cores[i].histogram[j] = 0;
+      }
+    }
 }
 
 /// Destructor
-ac_tlm_lock::~ac_tlm_lock() {}
+ac_tlm_lock::~ac_tlm_lock()
+{
+  delete[] cores;
+}
 
 /**
  * Read the current value in lock and mark it as taken. A read value of 0 means
@@ -47,3 +70,112 @@ ac_tlm_rsp_status ac_tlm_lock::write_lock(const uint32_t &d)
   lock = d;
   return SUCCESS;
 }
+
+/**
+ * Find out which core issued the request. Requests that did not go through a
+ * tagged router export, such as filter DMA, belong to no core.
+ * @param request the received request packet
+ * @returns the index of the issuing core, or -1
+ */
+int ac_tlm_lock::get_core(const ac_tlm_req &request)
+{
+  if (request.dev_id < 0 || request.dev_id >= num_cores) return -1;
+  return request.dev_id;
+}
+
+/**
+ * Hand out the next ticket. The core owns the lock once "now serving" reaches
+ * the returned value.
+ * @param core the core taking the ticket, or -1
+ * @param d will contain the ticket number
+ * @returns A TLM response packet with SUCCESS and a modified d
+ */
+ac_tlm_rsp_status ac_tlm_lock::take_ticket(int core, uint32_t &d)
+{
+  d = next_ticket++;
+  if (core < 0) return SUCCESS;
+
+  ticket_stats &stats = cores[core];
+  stats.waiting = true;
+  stats.ticket = d;
+  stats.ticket_time = sc_time_stamp();
+  return SUCCESS;
+}
+
+/**
+ * Read the ticket currently being served. When it matches the ticket held by
+ * the reading core, the time it waited for the lock is recorded.
+ * @param core the core polling the lock, or -1
+ * @param d will contain the ticket being served
+ * @returns A TLM response packet with SUCCESS and a modified d
+ */
+ac_tlm_rsp_status ac_tlm_lock::read_serving(int core, uint32_t &d)
+{
+  d = now_serving;
+  if (core < 0) return SUCCESS;
+
+  ticket_stats &stats = cores[core];
+  if (stats.waiting) {
+    ++stats.polls;
+    if (stats.ticket == now_serving) {
+      double wait = (sc_time_stamp() - stats.ticket_time) / sc_time(1, SC_NS);
+      int bucket = 0;
+      while (bucket < LOCK_HISTOGRAM_BUCKETS - 1 && wait >= (1ULL << bucket)) {
+        bucket++;
+      }
+      ++stats.histogram[bucket];
+      ++stats.acquisitions;
+      stats.total_wait += wait;
+      if (wait > stats.max_wait) stats.max_wait = wait;
+      stats.waiting = false;
+    }
+  }
+  return SUCCESS;
+}
+
+/**
+ * Release the ticket lock, passing it to the holder of the next ticket. The
+ * written value is ignored.
+ * @returns A TLM response packet with SUCCESS
+ */
+ac_tlm_rsp_status ac_tlm_lock::serve_next()
+{
+  now_serving++;
+  return SUCCESS;
+}
+
+/**
+ * Bucket i of a histogram counts acquisitions that waited less than 2^i ns
+ * (and at least 2^(i-1) ns); the last bucket also holds everything above.
+ */
+void ac_tlm_lock::print_stats()
+{
+  for (int i = 0; i < num_cores; i++) {
+    ticket_stats &stats = cores[i];
+    if (stats.acquisitions == 0) continue;
+
+    // Upper bound of the bucket that holds the 99th percentile
+    uint64_t seen = 0, p99 = 0;
+    for (int j = 0; j < LOCK_HISTOGRAM_BUCKETS; j++) {
+      seen += stats.histogram[j];
+      if (100 * seen >= 99 * stats.acquisitions) {
+        p99 = 1ULL << j;
+        break;
+      }
+    }
+
+    fprintf(stderr, "Lock core %d: %llu acquisitions, %llu polls, "
+            "mean wait %.1lf ns, p99 < %llu ns, max wait %.0lf ns\n",
+            i, (unsigned long long)stats.acquisitions,
+            (unsigned long long)stats.polls,
+            stats.total_wait / stats.acquisitions,
+            (unsigned long long)p99, stats.max_wait);
+    fprintf(stderr, "  histogram (ns):");
+    for (int j = 0; j < LOCK_HISTOGRAM_BUCKETS; j++) {
+      if (stats.histogram[j] == 0) continue;
+      fprintf(stderr, " <%llu:%llu", 1ULL << j,
+              (unsigned long long)stats.histogram[j]);
+    }
+    fprintf(stderr, "\n");
+  }
+}
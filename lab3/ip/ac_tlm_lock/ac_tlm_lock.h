@@ -19,6 +19,14 @@ using tlm::tlm_transport_if;
 
 //////////////////////////////////////////////////////////////////////////////
 
+#define LOCK_ADDRESS 0x600000
+#define LOCK_SIZE 0x10
+#define LOCK_INDEX_TAS 0x00
+#define LOCK_INDEX_TICKET 0x04
+#define LOCK_INDEX_SERVING 0x08
+
+#define LOCK_HISTOGRAM_BUCKETS 32
+
 //#define DEBUG
 
 /// Namespace to isolate lock from ArchC
@@ -45,12 +53,24 @@ public:
   ac_tlm_rsp transport(const ac_tlm_req &request) {
     // Check whether processor is trying to acquire or release the lock
     ac_tlm_rsp response;
+    uint32_t index = request.addr - LOCK_ADDRESS;
+    int core = get_core(request);
     switch (request.type) {
       case READ: // Read (and maybe acquire) lock
-        response.status = read_lock(response.data);
+        if (index == LOCK_INDEX_TICKET) {
+          response.status = take_ticket(core, response.data);
+        } else if (index == LOCK_INDEX_SERVING) {
+          response.status = read_serving(core, response.data);
+        } else {
+          response.status = read_lock(response.data);
+        }
         break;
       case WRITE: // Write (and maybe release) lock
-        response.status = write_lock(request.data);
+        if (index == LOCK_INDEX_SERVING) {
+          response.status = serve_next();
+        } else {
+          response.status = write_lock(request.data);
+        }
         break;
       default:
         response.status = ERROR;
@@ -61,19 +81,50 @@ public:
 
   /**
    * Default constructor.
+   *
+   * @param num_cores number of cores the router tags requests with
    */
-  ac_tlm_lock(sc_module_name module_name);
+  ac_tlm_lock(sc_module_name module_name, int num_cores);
 
   /**
    * Default destructor.
    */
   ~ac_tlm_lock();
 
+  /**
+   * Print the ticket lock wait-time histograms of every core that used it.
+   */
+  void print_stats();
+
 private:
   /// Lock - released on 0, taken otherwise
   uint32_t lock;
+  /// Next ticket to be handed out
+  uint32_t next_ticket;
+  /// Ticket currently allowed to hold the lock
+  uint32_t now_serving;
+
+  /// Per-core state of the ticket lock
+  struct ticket_stats {
+    bool waiting;
+    uint32_t ticket;
+    sc_time ticket_time;
+    uint64_t acquisitions;
+    uint64_t polls;
+    double total_wait;
+    double max_wait;
+    uint64_t histogram[LOCK_HISTOGRAM_BUCKETS];
+  };
+  /// Indexed by core, requests from any other master are not accounted
+  ticket_stats *cores;
+  int num_cores;
+
+  int get_core(const ac_tlm_req &);
   ac_tlm_rsp_status read_lock(uint32_t &);
   ac_tlm_rsp_status write_lock(const uint32_t &);
+  ac_tlm_rsp_status take_ticket(int, uint32_t &);
+  ac_tlm_rsp_status read_serving(int, uint32_t &);
+  ac_tlm_rsp_status serve_next();
 };
 
 };
@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////
+// Standard includes
+// SystemC includes
+// ArchC includes
+
+#include "ac_tlm_mailbox.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+/// Namespace to isolate mailbox from ArchC
+using user::ac_tlm_mailbox;
+
+/// Constructor
+ac_tlm_mailbox::ac_tlm_mailbox(sc_module_name module_name, int depth)
+  : sc_module(module_name)
+  , target_export("iport")
+  , depth(depth)
+{
+    /// Binds target_export to the mailbox
+    target_export(*this);
+
+    for (int i = 0; i < MAILBOX_NUM_QUEUES; i++) {
+      queues[i].words.resize(depth);
+      queues[i].head = 0;
+      queues[i].count = 0;
+      queues[i].enqueued = 0;
+      queues[i].blocked_writes = 0;
+      queues[i].blocked_reads = 0;
+      queues[i].max_count = 0;
+      queues[i].occupancy = 0.0;
+    }
+}
+
+/// Destructor
+ac_tlm_mailbox::~ac_tlm_mailbox() {}
+
+/**
+ * Integrate the queue occupancy over time, to be called right before the
+ * number of words in the queue changes.
+ * @param queue the queue about to change
+ */
+void ac_tlm_mailbox::account(mailbox_queue &queue)
+{
+  sc_time now = sc_time_stamp();
+  queue.occupancy += queue.count * ((now - queue.last_change) / sc_time(1, SC_NS));
+  queue.last_change = now;
+}
+
+/**
+ * Append a word to a queue. The writing core is suspended while the queue is
+ * full.
+ * @param q the queue being written
+ * @param d the word being enqueued
+ * @returns A TLM response packet with SUCCESS
+ */
+ac_tlm_rsp_status ac_tlm_mailbox::enqueue(uint32_t q, const uint32_t &d)
+{
+  mailbox_queue &queue = queues[q];
+  if (queue.count == depth) {
+    ++queue.blocked_writes;
+    while (queue.count == depth) wait(queue.not_full);
+  }
+
+  account(queue);
+  // Words are opaque to the mailbox, so they come out as they went in
+  queue.words[(queue.head + queue.count) % depth] = d;
+  queue.count++;
+  ++queue.enqueued;
+  if (queue.count > queue.max_count) queue.max_count = queue.count;
+  queue.not_empty.notify(SC_ZERO_TIME);
+  return SUCCESS;
+}
+
+/**
+ * Remove the oldest word from a queue. The reading core is suspended while the
+ * queue is empty.
+ * @param q the queue being read
+ * @param d will contain the dequeued word
+ * @returns A TLM response packet with SUCCESS and a modified d
+ */
+ac_tlm_rsp_status ac_tlm_mailbox::dequeue(uint32_t q, uint32_t &d)
+{
+  mailbox_queue &queue = queues[q];
+  if (queue.count == 0) {
+    ++queue.blocked_reads;
+    while (queue.count == 0) wait(queue.not_empty);
+  }
+
+  account(queue);
+  d = queue.words[queue.head];
+  queue.head = (queue.head + 1) % depth;
+  queue.count--;
+  queue.not_full.notify(SC_ZERO_TIME);
+  return SUCCESS;
+}
+
+/**
+ * Read how many words are waiting in a queue, without blocking.
+ * @param q the queue being inspected
+ * @param d will contain the occupancy of the queue
+ * @returns A TLM response packet with SUCCESS and a modified d
+ */
+ac_tlm_rsp_status ac_tlm_mailbox::read_status(uint32_t q, uint32_t &d)
+{
+  d = queues[q].count;
+  return SUCCESS;
+}
+
+void ac_tlm_mailbox::print_stats()
+{
+  for (int i = 0; i < MAILBOX_NUM_QUEUES; i++) {
+    mailbox_queue &queue = queues[i];
+    if (queue.enqueued == 0) continue;
+
+    account(queue);
+    double elapsed = sc_time_stamp() / sc_time(1, SC_NS);
+    fprintf(stderr, "Mailbox queue %d: %llu words, max occupancy %u/%u, "
+            "mean occupancy %.2lf, %llu blocked writes, %llu blocked reads\n",
+            i, (unsigned long long)queue.enqueued, queue.max_count, depth,
+            elapsed > 0.0 ? queue.occupancy / elapsed : 0.0,
+            (unsigned long long)queue.blocked_writes,
+            (unsigned long long)queue.blocked_reads);
+  }
+}
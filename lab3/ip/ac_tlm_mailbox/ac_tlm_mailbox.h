@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef AC_TLM_MAILBOX_H_
+#define AC_TLM_MAILBOX_H_
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <vector>
+// SystemC includes
+#include <systemc>
+// ArchC includes
+#include "ac_tlm_protocol.H"
+
+//////////////////////////////////////////////////////////////////////////////
+
+// using statements
+using tlm::tlm_transport_if;
+
+//////////////////////////////////////////////////////////////////////////////
+
+#define MAILBOX_ADDRESS 0x680000
+#define MAILBOX_NUM_QUEUES 8
+#define MAILBOX_QUEUE_OFFSET 0x10
+#define MAILBOX_SIZE (MAILBOX_NUM_QUEUES * MAILBOX_QUEUE_OFFSET)
+#define MAILBOX_INDEX_DATA 0x00
+#define MAILBOX_INDEX_STATUS 0x04
+#define MAILBOX_INDEX_CAPACITY 0x08
+
+//#define DEBUG
+
+/// Namespace to isolate mailbox from ArchC
+namespace user
+{
+
+/// A TLM mailbox with bounded FIFO queues
+class ac_tlm_mailbox :
+  public sc_module,
+  public ac_tlm_transport_if // Using ArchC TLM protocol
+{
+public:
+  /// Exposed port with ArchC interface
+  sc_export<ac_tlm_transport_if> target_export;
+
+  /**
+   * Implementation of TLM transport method that handle packets of the protocol
+   * doing apropriate actions. This method must be implemented (required by
+   * SystemC TLM).
+   *
+   * @param request a received request packet
+   * @return a response packet to be sent
+   */
+  ac_tlm_rsp transport(const ac_tlm_req &request) {
+    ac_tlm_rsp response;
+    uint32_t offset = request.addr - MAILBOX_ADDRESS;
+    uint32_t queue = offset / MAILBOX_QUEUE_OFFSET;
+    uint32_t index = offset % MAILBOX_QUEUE_OFFSET;
+
+    response.status = ERROR;
+    if (queue >= MAILBOX_NUM_QUEUES) return response;
+
+    switch (request.type) {
+      case READ: // Dequeue or read queue state
+        if (index == MAILBOX_INDEX_DATA) {
+          response.status = dequeue(queue, response.data);
+        } else if (index == MAILBOX_INDEX_STATUS) {
+          response.status = read_status(queue, response.data);
+        } else if (index == MAILBOX_INDEX_CAPACITY) {
+          response.data = depth;
+          response.status = SUCCESS;
+        }
+        break;
+      case WRITE: // Enqueue
+        if (index == MAILBOX_INDEX_DATA) {
+          response.status = enqueue(queue, request.data);
+        }
+        break;
+      default:
+        break;
+    }
+    return response;
+  }
+
+  /**
+   * Default constructor.
+   *
+   * @param depth number of words each queue can hold
+   */
+  ac_tlm_mailbox(sc_module_name module_name, int depth = 16);
+
+  /**
+   * Default destructor.
+   */
+  ~ac_tlm_mailbox();
+
+  /**
+   * Print throughput and occupancy statistics of the queues that were used.
+   */
+  void print_stats();
+
+private:
+  /// A bounded FIFO queue
+  struct mailbox_queue {
+    std::vector<uint32_t> words;
+    uint32_t head;
+    uint32_t count;
+    sc_event not_empty;
+    sc_event not_full;
+
+    uint64_t enqueued;
+    uint64_t blocked_writes;
+    uint64_t blocked_reads;
+    uint32_t max_count;
+    double occupancy;
+    sc_time last_change;
+  };
+
+  uint32_t depth;
+  mailbox_queue queues[MAILBOX_NUM_QUEUES];
+
+  void account(mailbox_queue &);
+  ac_tlm_rsp_status enqueue(uint32_t, const uint32_t &);
+  ac_tlm_rsp_status dequeue(uint32_t, uint32_t &);
+  ac_tlm_rsp_status read_status(uint32_t, uint32_t &);
+};
+
+};
+
+#endif //AC_TLM_MAILBOX_H_
@@ -0,0 +1,21 @@
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef AC_TLM_ADDRESS_MAP_H_
+#define AC_TLM_ADDRESS_MAP_H_
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Parts of the router's address map that processor models rely on as well
+
+/// Size of the memory behind the router; devices are mapped above it
+#define MEMORY_SIZE 5242880U
+
+/// Wait-for-event registers, implemented by the router itself
+#define WFE_ADDRESS 0x660000
+#define WFE_SIZE 0x10
+#define WFE_INDEX_MONITOR 0x00
+#define WFE_INDEX_WAIT 0x04
+#define WFE_INDEX_SEV 0x08
+#define WFE_INDEX_CLEAR 0x0C
+
+#endif //AC_TLM_ADDRESS_MAP_H_
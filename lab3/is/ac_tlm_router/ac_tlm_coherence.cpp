@@ -0,0 +1,231 @@
+//////////////////////////////////////////////////////////////////////////////
+// Standard includes
+// SystemC includes
+// ArchC includes
+
+#include "ac_tlm_coherence.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+using user::ac_tlm_coherence;
+
+/// Constructor
+ac_tlm_coherence::ac_tlm_coherence(int num_cores, coherence_protocol protocol)
+  : protocol(protocol)
+  , caches(num_cores < COHERENCE_MAX_CORES ? num_cores : COHERENCE_MAX_CORES)
+  , bus_reads(0)
+  , bus_read_exclusives(0)
+  , bus_upgrades(0)
+{
+  for (size_t i = 0; i < caches.size(); i++) {
+    memset(&caches[i], 0, sizeof(core_cache));
+  }
+}
+
+void ac_tlm_coherence::access(int core, uint32_t address, bool is_write)
+{
+  uint32_t line = address / COHERENCE_LINE_SIZE;
+  uint32_t word = address % COHERENCE_LINE_SIZE / 4;
+
+  if (core < 0 || core >= (int) caches.size()) {
+    // Agents without a cache read memory as it is and invalidate what they
+    // write
+    if (is_write) {
+      snoop_write(core, line);
+      record_write(core, line, word);
+    } else {
+      snoop_read(core, line);
+    }
+    return;
+  }
+
+  core_cache &cache = caches[core];
+  cache_line *entry = find(cache, line);
+  ++cache.clock;
+  if (is_write) ++cache.writes;
+  else ++cache.reads;
+
+  if (entry == NULL) {
+    if (is_write) ++cache.write_misses;
+    else ++cache.read_misses;
+    classify_miss(core, line, word);
+
+    entry = allocate(cache, line);
+    if (is_write) {
+      ++bus_read_exclusives;
+      snoop_write(core, line);
+      entry->state = STATE_MODIFIED;
+    } else {
+      ++bus_reads;
+      bool shared = snoop_read(core, line);
+      entry->state = shared || protocol == PROTOCOL_MSI ? STATE_SHARED
+                                                       : STATE_EXCLUSIVE;
+    }
+  } else if (is_write && entry->state == STATE_SHARED) {
+    ++cache.upgrades;
+    ++bus_upgrades;
+    snoop_write(core, line);
+    entry->state = STATE_MODIFIED;
+  } else if (is_write) {
+    // Exclusive lines become modified without telling anyone
+    entry->state = STATE_MODIFIED;
+  }
+
+  entry->last_use = cache.clock;
+  if (is_write) record_write(core, line, word);
+}
+
+/**
+ * Look a line up in a cache.
+ * @returns the entry holding the line, or NULL if it is not there
+ */
+ac_tlm_coherence::cache_line *ac_tlm_coherence::find(core_cache &cache,
+                                                     uint32_t line)
+{
+  cache_line *set = cache.lines + line % COHERENCE_NUM_SETS *
+                                  COHERENCE_NUM_WAYS;
+  for (int way = 0; way < COHERENCE_NUM_WAYS; way++) {
+    if (set[way].state != STATE_INVALID && set[way].line == line) {
+      return &set[way];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Make room for a line, replacing an invalid entry or the least recently used
+ * one, which is written back if modified.
+ * @returns the entry for the line, still invalid
+ */
+ac_tlm_coherence::cache_line *ac_tlm_coherence::allocate(core_cache &cache,
+                                                         uint32_t line)
+{
+  cache_line *set = cache.lines + line % COHERENCE_NUM_SETS *
+                                  COHERENCE_NUM_WAYS;
+  cache_line *victim = &set[0];
+  for (int way = 0; way < COHERENCE_NUM_WAYS; way++) {
+    if (set[way].state == STATE_INVALID) {
+      victim = &set[way];
+      break;
+    }
+    if (set[way].last_use < victim->last_use) victim = &set[way];
+  }
+
+  if (victim->state == STATE_MODIFIED) ++cache.writebacks;
+  victim->line = line;
+  victim->state = STATE_INVALID;
+  return victim;
+}
+
+/**
+ * Let the other caches see a read of a line: a modified copy is supplied and
+ * written back, and every copy ends up shared.
+ * @returns whether any other cache holds the line
+ */
+bool ac_tlm_coherence::snoop_read(int core, uint32_t line)
+{
+  bool shared = false;
+
+  for (int i = 0; i < (int) caches.size(); i++) {
+    if (i == core) continue;
+    cache_line *entry = find(caches[i], line);
+    if (entry == NULL) continue;
+
+    if (entry->state == STATE_MODIFIED) {
+      ++caches[i].interventions;
+      ++caches[i].writebacks;
+    }
+    entry->state = STATE_SHARED;
+    shared = true;
+  }
+  return shared;
+}
+
+/**
+ * Invalidate the copies of a line held by the other caches, a modified copy
+ * being supplied first. Their owners are remembered so that their next miss
+ * on the line can be classified.
+ */
+void ac_tlm_coherence::snoop_write(int core, uint32_t line)
+{
+  for (int i = 0; i < (int) caches.size(); i++) {
+    if (i == core) continue;
+    cache_line *entry = find(caches[i], line);
+    if (entry == NULL) continue;
+
+    if (entry->state == STATE_MODIFIED) ++caches[i].interventions;
+    entry->state = STATE_INVALID;
+    ++caches[i].invalidations;
+
+    lost_line &lost = lost_lines[line];
+    lost.cores |= 1U << i;
+    lost.written[i] = 0;
+  }
+}
+
+/**
+ * Count a miss as a coherence miss if the core lost the line to an
+ * invalidation, and as false sharing if the word it wants was not written
+ * since.
+ */
+void ac_tlm_coherence::classify_miss(int core, uint32_t line, uint32_t word)
+{
+  std::map<uint32_t, lost_line>::iterator it = lost_lines.find(line);
+  if (it == lost_lines.end() || !(it->second.cores >> core & 1)) return;
+
+  core_cache &cache = caches[core];
+  ++cache.coherence_misses;
+  if (!(it->second.written[core] >> word & 1)) ++cache.false_sharing_misses;
+
+  it->second.cores &= ~(1U << core);
+  if (it->second.cores == 0) lost_lines.erase(it);
+}
+
+/**
+ * Note a word written by some agent in the lines lost by the other cores.
+ */
+void ac_tlm_coherence::record_write(int core, uint32_t line, uint32_t word)
+{
+  std::map<uint32_t, lost_line>::iterator it = lost_lines.find(line);
+  if (it == lost_lines.end()) return;
+
+  for (int i = 0; i < (int) caches.size(); i++) {
+    if (i != core && (it->second.cores >> i & 1)) {
+      it->second.written[i] |= 1U << word;
+    }
+  }
+}
+
+void ac_tlm_coherence::print_stats()
+{
+  fprintf(stderr, "Coherence (%s, %d-byte unified I+D cache per core): "
+          "%llu bus reads, %llu read-exclusives, %llu upgrades\n",
+          protocol == PROTOCOL_MSI ? "MSI" : "MESI",
+          COHERENCE_NUM_SETS * COHERENCE_NUM_WAYS * COHERENCE_LINE_SIZE,
+          (unsigned long long)bus_reads,
+          (unsigned long long)bus_read_exclusives,
+          (unsigned long long)bus_upgrades);
+
+  for (int i = 0; i < (int) caches.size(); i++) {
+    core_cache &cache = caches[i];
+    uint64_t accesses = cache.reads + cache.writes;
+    if (accesses == 0) continue;
+
+    fprintf(stderr, "I+D cache core %d: %llu reads, %llu writes, "
+            "%.2lf%% misses, %llu upgrades, %llu writebacks\n", i,
+            (unsigned long long)cache.reads,
+            (unsigned long long)cache.writes,
+            100.0 * (cache.read_misses + cache.write_misses) / accesses,
+            (unsigned long long)cache.upgrades,
+            (unsigned long long)cache.writebacks);
+    fprintf(stderr, "  %llu invalidations, %llu interventions, "
+            "%llu coherence misses (%llu from false sharing)\n",
+            (unsigned long long)cache.invalidations,
+            (unsigned long long)cache.interventions,
+            (unsigned long long)cache.coherence_misses,
+            (unsigned long long)cache.false_sharing_misses);
+  }
+}
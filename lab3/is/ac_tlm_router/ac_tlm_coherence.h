@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef AC_TLM_COHERENCE_H_
+#define AC_TLM_COHERENCE_H_
+
+//////////////////////////////////////////////////////////////////////////////
+
+// Standard includes
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+
+#define COHERENCE_LINE_SIZE 32
+#define COHERENCE_NUM_SETS 64
+#define COHERENCE_NUM_WAYS 4
+#define COHERENCE_MAX_CORES 32
+
+/// Namespace to isolate router from ArchC
+namespace user
+{
+
+enum coherence_protocol {
+  PROTOCOL_MSI,
+  PROTOCOL_MESI
+};
+
+/**
+ * Private L1 caches of the cores kept coherent by snooping the router, tags
+ * only. Data always comes from memory, so the guest sees no difference; the
+ * model counts what caches on the bus would have to do: misses, upgrades,
+ * invalidations, interventions and which coherence misses were caused by
+ * false sharing.
+ *
+ * The bus carries instruction fetches and loads alike, so each cache holds
+ * both. Code is never written and never causes coherence traffic.
+ */
+class ac_tlm_coherence
+{
+public:
+  /**
+   * @param num_cores number of cores with a cache, up to COHERENCE_MAX_CORES
+   * @param protocol MSI, or MESI to let lines read by a single core be
+   *                 written without a bus upgrade
+   */
+  ac_tlm_coherence(int num_cores, coherence_protocol protocol);
+
+  /**
+   * Update the caches for an access to memory.
+   * @param core the core making the access, or any other value for agents
+   *             without a cache, such as devices moving data
+   * @param address the address being accessed
+   * @param is_write whether the access is a write
+   */
+  void access(int core, uint32_t address, bool is_write);
+
+  /**
+   * Print the traffic each core caused and received. Reads and misses
+   * include instruction fetches; the coherence counters only ever involve
+   * data.
+   */
+  void print_stats();
+
+private:
+  enum line_state {
+    STATE_INVALID,
+    STATE_SHARED,
+    STATE_EXCLUSIVE,
+    STATE_MODIFIED
+  };
+
+  struct cache_line {
+    uint32_t line;
+    line_state state;
+    uint64_t last_use;
+  };
+
+  struct core_cache {
+    /// Indexed by set * COHERENCE_NUM_WAYS + way
+    cache_line lines[COHERENCE_NUM_SETS * COHERENCE_NUM_WAYS];
+    uint64_t clock;
+
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_misses;
+    uint64_t write_misses;
+    uint64_t upgrades;
+    uint64_t writebacks;
+    /// Misses on lines lost to a write by another agent
+    uint64_t coherence_misses;
+    /// Coherence misses on a word nobody wrote since the line was lost
+    uint64_t false_sharing_misses;
+    /// Copies lost to a write by another agent
+    uint64_t invalidations;
+    /// Modified lines supplied to another agent
+    uint64_t interventions;
+  };
+
+  /// Words written to a line since each core lost it to an invalidation
+  struct lost_line {
+    uint32_t cores;
+    uint32_t written[COHERENCE_MAX_CORES];
+  };
+
+  coherence_protocol protocol;
+  std::vector<core_cache> caches;
+  std::map<uint32_t, lost_line> lost_lines;
+
+  uint64_t bus_reads;
+  uint64_t bus_read_exclusives;
+  uint64_t bus_upgrades;
+
+  cache_line *find(core_cache &, uint32_t);
+  cache_line *allocate(core_cache &, uint32_t);
+  bool snoop_read(int, uint32_t);
+  void snoop_write(int, uint32_t);
+  void classify_miss(int, uint32_t, uint32_t);
+  void record_write(int, uint32_t, uint32_t);
+};
+
+};
+
+#endif //AC_TLM_COHERENCE_H_
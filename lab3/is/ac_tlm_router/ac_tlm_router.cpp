@@ -7,6 +7,8 @@
 
 //////////////////////////////////////////////////////////////////////////////
 
+#include <stdio.h>
+
 /// Namespace to isolate router from ArchC
 using user::ac_tlm_router;
 
@@ -14,19 +16,186 @@ using user::ac_tlm_router;
 ac_tlm_router::ac_tlm_router(sc_module_name module_name)
   : sc_module(module_name)
   , target_export("iport")
-  , mem_port("mem_port", 5242880U)
-  , lock_port("lock_port", 4U)
-{
-    // Initialize ports for the filters
-    char port_names[NUM_FILTERS][16];
-    for (int i = 0; i < NUM_FILTERS; i++) {
-      sprintf(port_names[i], "filter_port_%d", i);
-      filter_ports[i] = new ac_tlm_port(port_names[i], 44U);
-    }
-
+  , mem_port("mem_port", MEMORY_SIZE)
+  , lock_port("lock_port", LOCK_SIZE)
+  , mailbox_port("mailbox_port", MAILBOX_SIZE)
+  , filter_port("filter_port", FILTER_SIZE)
+  , armed_cores(0)
+  , coherence(NUM_PROC, COHERENCE_PROTOCOL)
+{
     /// Binds target_export to the router
     target_export(*this);
+
+    // Initialize one tagged export per core
+    char export_names[NUM_PROC][16];
+    for (int i = 0; i < NUM_PROC; i++) {
+      sprintf(export_names[i], "core_export_%d", i);
+      core_tags[i] = new ac_tlm_core_tag(*this, i);
+      core_exports[i] = new sc_export<ac_tlm_transport_if>(export_names[i]);
+      (*core_exports[i])(*core_tags[i]);
+
+      monitors[i].num_addresses = 0;
+      monitors[i].pending = false;
+      monitors[i].sleeps = 0;
+      monitors[i].sleep_time = 0.0;
+    }
 }
 
 /// Destructor
-ac_tlm_router::~ac_tlm_router() {}
+ac_tlm_router::~ac_tlm_router()
+{
+  for (int i = 0; i < NUM_PROC; i++) {
+    delete core_exports[i];
+    delete core_tags[i];
+  }
+}
+
+/**
+ * Forward a request to a device. Data travels on the bus in target (big
+ * endian) byte order while devices keep their registers in host order, so the
+ * word is swapped here once on the way in and once on the way out. Memory is
+ * left in target order and never goes through here.
+ * @param port the port the device is bound to
+ * @param request a received request packet
+ * @returns the device response, in target byte order
+ */
+ac_tlm_rsp ac_tlm_router::device_transport(ac_tlm_port &port,
+                                           const ac_tlm_req &request)
+{
+  ac_tlm_req host_request = request;
+  host_request.data = __builtin_bswap32(request.data);
+
+  ac_tlm_rsp response = port->transport(host_request);
+  response.data = __builtin_bswap32(response.data);
+  return response;
+}
+
+/**
+ * Handle an access to the wait-for-event registers. A core arms its monitor by
+ * writing addresses to WFE_INDEX_MONITOR and then reads WFE_INDEX_WAIT, which
+ * only returns after some core writes to one of those addresses. A write to
+ * WFE_INDEX_SEV wakes every sleeping core, and a write to WFE_INDEX_CLEAR
+ * drops the monitored addresses without waiting.
+ * @param request a received request packet
+ * @returns a response packet to be sent
+ */
+ac_tlm_rsp ac_tlm_router::event_transport(const ac_tlm_req &request)
+{
+  ac_tlm_rsp response;
+  uint32_t index = request.addr - WFE_ADDRESS;
+  int core = request.dev_id;
+
+  response.status = SUCCESS;
+  response.data = 0;
+
+  if (index == WFE_INDEX_SEV && request.type == WRITE) {
+    send_event();
+  } else if (core < 0 || core >= NUM_PROC) {
+    // Untagged requests can't be told apart, so they never sleep
+  } else if (index == WFE_INDEX_MONITOR && request.type == WRITE) {
+    // The router is the device here, so it converts from target byte order
+    arm_monitor(core, __builtin_bswap32(request.data));
+  } else if (index == WFE_INDEX_WAIT && request.type == READ) {
+    wait_for_event(core);
+  } else if (index == WFE_INDEX_CLEAR && request.type == WRITE) {
+    disarm(core);
+  } else {
+    response.status = ERROR;
+  }
+
+  return response;
+}
+
+/**
+ * Start watching writes to the word that contains the given address.
+ * @param core the core arming its monitor
+ * @param address the address to be watched
+ */
+void ac_tlm_router::arm_monitor(int core, uint32_t address)
+{
+  event_monitor &monitor = monitors[core];
+  if (monitor.num_addresses == WFE_MAX_MONITORS) {
+    // Out of slots: wake up right away rather than risk missing the write
+    monitor.pending = true;
+    return;
+  }
+  if (monitor.num_addresses == 0) {
+    monitor.pending = false;
+    armed_cores++;
+  }
+  monitor.addresses[monitor.num_addresses++] = address & ~3U;
+}
+
+/**
+ * Suspend the calling core until one of its monitored addresses is written.
+ * Returns immediately if that already happened after the monitor was armed.
+ * @param core the core going to sleep
+ */
+void ac_tlm_router::wait_for_event(int core)
+{
+  event_monitor &monitor = monitors[core];
+  if (!monitor.pending && monitor.num_addresses > 0) {
+    sc_time start = sc_time_stamp();
+    ++monitor.sleeps;
+    wait(monitor.wake);
+    monitor.sleep_time += (sc_time_stamp() - start) / sc_time(1, SC_NS);
+  }
+  disarm(core);
+}
+
+/**
+ * Wake up every core, whatever it is monitoring.
+ */
+void ac_tlm_router::send_event()
+{
+  for (int i = 0; i < NUM_PROC; i++) {
+    if (monitors[i].num_addresses > 0) {
+      monitors[i].pending = true;
+      monitors[i].wake.notify(SC_ZERO_TIME);
+    }
+  }
+}
+
+/**
+ * Wake up the cores monitoring the word being written.
+ * @param address the address being written
+ */
+void ac_tlm_router::signal_monitors(uint32_t address)
+{
+  address &= ~3U;
+  for (int i = 0; i < NUM_PROC; i++) {
+    event_monitor &monitor = monitors[i];
+    for (int j = 0; j < monitor.num_addresses; j++) {
+      if (monitor.addresses[j] == address) {
+        monitor.pending = true;
+        monitor.wake.notify(SC_ZERO_TIME);
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * Clear every address monitored by a core.
+ * @param core the core whose monitor is cleared
+ */
+void ac_tlm_router::disarm(int core)
+{
+  event_monitor &monitor = monitors[core];
+  if (monitor.num_addresses > 0) {
+    monitor.num_addresses = 0;
+    armed_cores--;
+  }
+  monitor.pending = false;
+}
+
+void ac_tlm_router::print_stats()
+{
+  for (int i = 0; i < NUM_PROC; i++) {
+    if (monitors[i].sleeps == 0) continue;
+    fprintf(stderr, "Core %d: slept %llu times waiting for events, "
+            "%.0lf ns asleep\n", i, (unsigned long long)monitors[i].sleeps,
+            monitors[i].sleep_time);
+  }
+  coherence.print_stats();
+}
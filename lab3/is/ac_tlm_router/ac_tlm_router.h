@@ -11,6 +11,9 @@
 // ArchC includes
 #include "ac_tlm_port.H"
 #include "ac_tlm_protocol.H"
+// Router includes
+#include "ac_tlm_address_map.h"
+#include "ac_tlm_coherence.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -19,10 +22,19 @@ using tlm::tlm_transport_if;
 
 //////////////////////////////////////////////////////////////////////////////
 
-#define NUM_FILTERS 4
+#define NUM_PROC 8
 #define LOCK_ADDRESS 0x600000
+#define LOCK_SIZE 0x10
+#define MAILBOX_ADDRESS 0x680000
+#define MAILBOX_NUM_QUEUES 8
+#define MAILBOX_QUEUE_OFFSET 0x10
+#define MAILBOX_SIZE (MAILBOX_NUM_QUEUES * MAILBOX_QUEUE_OFFSET)
+#define WFE_MAX_MONITORS 4
 #define FILTER_ADDRESS 0x700000
-#define FILTER_ADDRESS_OFFSET 44
+#define FILTER_ADDRESS_OFFSET 0x100
+#define NUM_FILTER_CONTEXTS NUM_PROC
+#define FILTER_SIZE (NUM_FILTER_CONTEXTS * FILTER_ADDRESS_OFFSET)
+#define COHERENCE_PROTOCOL PROTOCOL_MESI
 
 //#define DEBUG
 
@@ -30,6 +42,25 @@ using tlm::tlm_transport_if;
 namespace user
 {
 
+class ac_tlm_router;
+
+/// Stamps the identifier of the issuing core on every request it forwards
+class ac_tlm_core_tag :
+  public ac_tlm_transport_if // Using ArchC TLM protocol
+{
+public:
+  ac_tlm_core_tag(ac_tlm_router &router, int core_id)
+    : router(router)
+    , core_id(core_id)
+  {}
+
+  ac_tlm_rsp transport(const ac_tlm_req &request);
+
+private:
+  ac_tlm_router &router;
+  int core_id;
+};
+
 /// A TLM router
 class ac_tlm_router :
   public sc_module,
@@ -40,11 +71,15 @@ public:
   ac_tlm_port mem_port;
   /// Port to lock device
   ac_tlm_port lock_port;
-  /// Ports to filter device
-  ac_tlm_port *filter_ports[NUM_FILTERS];
+  /// Port to mailbox device
+  ac_tlm_port mailbox_port;
+  /// Port to filter device, one register context per core
+  ac_tlm_port filter_port;
 
   /// Exposed port with ArchC interface
   sc_export<ac_tlm_transport_if> target_export;
+  /// Exposed ports that tag requests with the id of the core bound to them
+  sc_export<ac_tlm_transport_if> *core_exports[NUM_PROC];
 
   /**
    * Implementation of TLM transport method that handle packets of the protocol
@@ -55,15 +90,25 @@ public:
    * @return a response packet to be sent
    */
   ac_tlm_rsp transport(const ac_tlm_req &request) {
-    for (int i = 0; i < NUM_FILTERS; i++) {
-      if (request.addr >= FILTER_ADDRESS + i * FILTER_ADDRESS_OFFSET &&
-          request.addr <  FILTER_ADDRESS + (i + 1) * FILTER_ADDRESS_OFFSET) {
-        return (*filter_ports[i])->transport(request);
-      }
+    if (request.addr >= WFE_ADDRESS &&
+        request.addr <  WFE_ADDRESS + WFE_SIZE) {
+      return event_transport(request);
+    }
+    if (request.type == WRITE && armed_cores > 0) {
+      signal_monitors(request.addr);
     }
-    if (request.addr == LOCK_ADDRESS) {
-      return lock_port->transport(request);
+
+    if (request.addr >= FILTER_ADDRESS &&
+        request.addr <  FILTER_ADDRESS + FILTER_SIZE) {
+      return device_transport(filter_port, request);
+    } else if (request.addr >= LOCK_ADDRESS &&
+        request.addr <  LOCK_ADDRESS + LOCK_SIZE) {
+      return device_transport(lock_port, request);
+    } else if (request.addr >= MAILBOX_ADDRESS &&
+               request.addr <  MAILBOX_ADDRESS + MAILBOX_SIZE) {
+      return device_transport(mailbox_port, request);
     } else {
+      coherence.access(request.dev_id, request.addr, request.type == WRITE);
       return mem_port->transport(request);
     }
   }
@@ -77,8 +122,51 @@ public:
    * Default destructor.
    */
   ~ac_tlm_router();
+
+  /**
+   * Print how often each core slept waiting for an event, and the traffic of
+   * the modelled unified I+D caches.
+   */
+  void print_stats();
+
+private:
+  ac_tlm_core_tag *core_tags[NUM_PROC];
+
+  /// Wait-for-event state of a core
+  struct event_monitor {
+    uint32_t addresses[WFE_MAX_MONITORS];
+    int num_addresses;
+    bool pending;
+    sc_event wake;
+    uint64_t sleeps;
+    double sleep_time;
+  };
+  event_monitor monitors[NUM_PROC];
+  /// Number of cores with at least one monitored address
+  int armed_cores;
+
+  /// Unified I+D caches the cores would have in front of memory
+  ac_tlm_coherence coherence;
+
+  ac_tlm_rsp device_transport(ac_tlm_port &, const ac_tlm_req &);
+  ac_tlm_rsp event_transport(const ac_tlm_req &);
+  void arm_monitor(int, uint32_t);
+  void wait_for_event(int);
+  void send_event();
+  void signal_monitors(uint32_t);
+  void disarm(int);
 };
 
+/**
+ * Forward the request to the router, marking which core issued it so that
+ * devices can keep per-core state.
+ */
+inline ac_tlm_rsp ac_tlm_core_tag::transport(const ac_tlm_req &request) {
+  ac_tlm_req tagged = request;
+  tagged.dev_id = core_id;
+  return router.transport(tagged);
+}
+
 };
 
 #endif //AC_TLM_ROUTER_H_
@@ -8,14 +8,16 @@ const char *archc_options="-abi -dy ";
 #include  "ac_tlm_mem.h"
 #include  "ac_tlm_lock.h"
 #include  "ac_tlm_filter.h"
+#include  "ac_tlm_mailbox.h"
 #include  "ac_tlm_router.h"
 
-#define NUM_PROC 8
-#define NUM_FILTERS 4
+// NUM_PROC, the number of cores, comes from the router
+#define NUM_FILTER_UNITS 4
 
 using user::ac_tlm_mem;
 using user::ac_tlm_lock;
 using user::ac_tlm_filter;
+using user::ac_tlm_mailbox;
 using user::ac_tlm_router;
 
 int sc_main(int ac, char *av[])
@@ -28,14 +30,11 @@ int sc_main(int ac, char *av[])
     sprintf(names[i], "mips1_%d", i);
     processors[i] = new mips1(names[i]);
   }
-  char filter_names[NUM_FILTERS][10];
-  ac_tlm_filter *filters[NUM_FILTERS];
-  for (int i = 0; i < NUM_FILTERS; i++) {
-    sprintf(filter_names[i], "filter_%d", i);
-    filters[i] = new ac_tlm_filter(filter_names[i], i);
-  }
+  //! One filter context per core, sharing the compute units
+  ac_tlm_filter filter("filter", NUM_PROC, NUM_FILTER_UNITS);
   ac_tlm_mem mem("mem");
-  ac_tlm_lock lock("lock");
+  ac_tlm_lock lock("lock", NUM_PROC);
+  ac_tlm_mailbox mailbox("mailbox");
   ac_tlm_router router("router");
 
 #ifdef AC_DEBUG
@@ -44,13 +43,13 @@ int sc_main(int ac, char *av[])
 
   // Link ports
   for (int i = 0; i < NUM_PROC; i++) {
-    processors[i]->DM_port(router.target_export);
-  }
-  for (int i = 0; i < NUM_FILTERS; i++) {
-    (*router.filter_ports[i])(filters[i]->target_export);
+    processors[i]->DM_port(*router.core_exports[i]);
   }
+  router.filter_port(filter.target_export);
+  filter.mem_port(router.target_export);
   router.mem_port(mem.target_export);
   router.lock_port(lock.target_export);
+  router.mailbox_port(mailbox.target_export);
 
   // Replicate arguments
   char **argvs[NUM_PROC];
@@ -78,6 +77,11 @@ int sc_main(int ac, char *av[])
     processors[i]->PrintStat();
   }
   cerr << endl;
+  lock.print_stats();
+  router.print_stats();
+  mailbox.print_stats();
+  filter.print_stats();
+  cerr << endl;
 
 #ifdef AC_STATS
   for (int i = 0; i < NUM_PROC; i++) {
@@ -100,9 +104,6 @@ int sc_main(int ac, char *av[])
   for (int i = 0; i < NUM_PROC; i++) {
     processors[i]->~mips1();
   }
-  for (int i = 0; i < NUM_FILTERS; i++) {
-    filters[i]->~ac_tlm_filter();
-  }
 
   return processors[0]->ac_exit_status;
 }
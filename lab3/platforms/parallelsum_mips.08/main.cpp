@@ -7,12 +7,16 @@ const char *archc_options="-abi -dy ";
 #include  "mips1.H"
 #include  "ac_tlm_mem.h"
 #include  "ac_tlm_lock.h"
+#include  "ac_tlm_filter.h"
+#include  "ac_tlm_mailbox.h"
 #include  "ac_tlm_router.h"
 
-#define NUM_PROC 8
+// NUM_PROC, the number of cores, comes from the router
 
 using user::ac_tlm_mem;
 using user::ac_tlm_lock;
+using user::ac_tlm_filter;
+using user::ac_tlm_mailbox;
 using user::ac_tlm_router;
 
 int sc_main(int ac, char *av[])
@@ -26,7 +30,10 @@ int sc_main(int ac, char *av[])
     processors[i] = new mips1(names[i]);
   }
   ac_tlm_mem mem("mem");
-  ac_tlm_lock lock("lock");
+  ac_tlm_lock lock("lock", NUM_PROC);
+  //! Not used by parallel_sum, but every router port must be bound
+  ac_tlm_filter filter("filter", NUM_PROC, 1);
+  ac_tlm_mailbox mailbox("mailbox");
   ac_tlm_router router("router");
 
 #ifdef AC_DEBUG
@@ -35,10 +42,13 @@ int sc_main(int ac, char *av[])
 
   // Link ports
   for (int i = 0; i < NUM_PROC; i++) {
-    processors[i]->DM_port(router.target_export);
+    processors[i]->DM_port(*router.core_exports[i]);
   }
   router.mem_port(mem.target_export);
   router.lock_port(lock.target_export);
+  router.filter_port(filter.target_export);
+  filter.mem_port(router.target_export);
+  router.mailbox_port(mailbox.target_export);
 
   // Replicate arguments
   char **argvs[NUM_PROC];
@@ -66,6 +76,9 @@ int sc_main(int ac, char *av[])
     processors[i]->PrintStat();
   }
   cerr << endl;
+  lock.print_stats();
+  router.print_stats();
+  cerr << endl;
 
 #ifdef AC_STATS
   for (int i = 0; i < NUM_PROC; i++) {
@@ -38,6 +38,12 @@
 #include  "mips1_isa_init.cpp"
 #include  "mips1_bhv_macros.H"
 
+#include <stdint.h>
+
+// Memory size and wait-for-event registers of the router, by path so that
+// the acsim-generated Makefile finds it too
+#include "../../is/ac_tlm_router/ac_tlm_address_map.h"
+
 
 //If you want debug information for this model, uncomment next line
 //#define DEBUG_MODEL
@@ -52,6 +58,302 @@
 // mips1-specific datatypes
 using namespace mips1_parms;
 
+// Loops longer than this many instructions are never considered spin loops
+#define SPIN_MAX_BODY 16
+// Maximum number of loads a spin loop may perform per iteration
+#define SPIN_MAX_LOADS 4
+// Identical iterations needed before the core is put to sleep
+#define SPIN_THRESHOLD 8
+
+// Slots of the per-processor table, a power of two above the number of
+// processors any platform has
+#define PER_PROCESSOR_SLOTS 64
+
+/**
+ * State of every processor, in a hash table keyed by the address of the
+ * processor's ISA object. The states are destroyed with the table, when the
+ * simulator exits.
+ */
+template <class T>
+class ProcessorTable
+{
+    const void *keys[PER_PROCESSOR_SLOTS];
+    T *states[PER_PROCESSOR_SLOTS];
+
+  public:
+
+    ProcessorTable() {
+      for (int i = 0; i < PER_PROCESSOR_SLOTS; i++) {
+        keys[i] = NULL;
+        states[i] = NULL;
+      }
+    }
+
+    ~ProcessorTable() {
+      for (int i = 0; i < PER_PROCESSOR_SLOTS; i++) {
+        delete states[i];
+      }
+    }
+
+    /**
+     * Returns the state of a processor, built on first use. The first probe
+     * almost always hits.
+     */
+    T& get(const void *processor) {
+      unsigned int slot = (uint64_t) (uintptr_t) processor *
+                          0x9E3779B97F4A7C15ULL >> 32 &
+                          (PER_PROCESSOR_SLOTS - 1);
+      for (int probes = 0; keys[slot] != processor; probes++) {
+        if (probes == PER_PROCESSOR_SLOTS) {
+          fprintf(stderr, "More than %d processors\n", PER_PROCESSOR_SLOTS);
+          exit(EXIT_FAILURE);
+        }
+        if (keys[slot] == NULL) {
+          states[slot] = new T();
+          keys[slot] = processor;
+          break;
+        }
+        slot = (slot + 1) & (PER_PROCESSOR_SLOTS - 1);
+      }
+      return *states[slot];
+    }
+};
+
+/**
+ * The behavior methods are shared by every mips1 instance in the platform, so
+ * state that belongs to a single processor is kept here.
+ */
+template <class T>
+T& per_processor(const void *processor)
+{
+  static ProcessorTable<T> table;
+  return table.get(processor);
+}
+
+/**
+ * Detects tight polling loops: short backward branches whose iterations only
+ * load the same values from the same memory addresses and leave every
+ * register untouched. Such a loop can only exit after another initiator
+ * writes to one of those addresses, so the core sleeps on the router's event
+ * monitor until that happens instead of executing the loop over and over.
+ *
+ * Device registers change without anyone writing to them, so loops that read
+ * one are left alone, and so are loops run while the guest has armed the
+ * monitor itself: the detector shares it and must not clear what it did not
+ * arm.
+ */
+class SpinDetector
+{
+    ac_word loopPC;
+    int matches;
+    bool armed;
+
+    // Memory accesses seen in the current iteration
+    bool stored;
+    bool readDevice;
+    int numLoads;
+    ac_word loadAddresses[SPIN_MAX_LOADS];
+    ac_word loadValues[SPIN_MAX_LOADS];
+
+    // Loads and register values from the previous iteration
+    int lastNumLoads;
+    ac_word lastLoadAddresses[SPIN_MAX_LOADS];
+    ac_word lastLoadValues[SPIN_MAX_LOADS];
+    // Only taken once the loop loads the same values twice in a row
+    bool haveRegisters;
+    ac_word registers[32];
+
+    // Whether the guest wrote addresses to the monitor and hasn't waited or
+    // cleared it since
+    bool guestArmed;
+
+    uint64_t numSleeps;
+    double sleepTime;
+    double skippedInstructions;
+
+    /**
+     * Whether this iteration loaded the same values as the previous one.
+     */
+    bool sameLoads() {
+      if (numLoads != lastNumLoads) return false;
+      for (int i = 0; i < numLoads; i++) {
+        if (loadAddresses[i] != lastLoadAddresses[i] ||
+            loadValues[i] != lastLoadValues[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void startIteration() {
+      lastNumLoads = numLoads;
+      for (int i = 0; i < numLoads; i++) {
+        lastLoadAddresses[i] = loadAddresses[i];
+        lastLoadValues[i] = loadValues[i];
+      }
+      numLoads = 0;
+      stored = false;
+      readDevice = false;
+    }
+
+    /**
+     * Gives up on the current loop, dropping the addresses armed for it.
+     */
+    template <class MEM>
+    void abandon(MEM &DM) {
+      if (armed && !guestArmed) DM.write(WFE_ADDRESS + WFE_INDEX_CLEAR, 0);
+      armed = false;
+      matches = 0;
+    }
+
+  public:
+
+    SpinDetector()
+      : loopPC(0)
+      , matches(0)
+      , armed(false)
+      , stored(false)
+      , readDevice(false)
+      , numLoads(0)
+      , lastNumLoads(0)
+      , haveRegisters(false)
+      , guestArmed(false)
+      , numSleeps(0)
+      , sleepTime(0.0)
+      , skippedInstructions(0.0)
+    {}
+
+    /**
+     * Records a load performed by the processor.
+     *
+     * @param address the address being read
+     * @param value   the value that was read
+     */
+    void noteLoad(ac_word address, ac_word value) {
+      if (address >= MEMORY_SIZE) {
+        readDevice = true;
+        // Waiting disarms the monitor
+        if (address == WFE_ADDRESS + WFE_INDEX_WAIT) guestArmed = false;
+        return;
+      }
+      if (numLoads < SPIN_MAX_LOADS) {
+        loadAddresses[numLoads] = address;
+        loadValues[numLoads] = value;
+      }
+      numLoads++;
+    }
+
+    /**
+     * Records a store performed by the processor.
+     *
+     * @param address the address being written
+     */
+    void noteStore(ac_word address) {
+      stored = true;
+      if (address == WFE_ADDRESS + WFE_INDEX_MONITOR) guestArmed = true;
+      if (address == WFE_ADDRESS + WFE_INDEX_CLEAR) guestArmed = false;
+    }
+
+    /**
+     * Called on every taken short backward branch, which ends an iteration of
+     * a candidate loop. Once the loop has been idle for SPIN_THRESHOLD
+     * iterations, the loaded addresses are armed in the event monitor, and if
+     * the following iteration is still identical the core goes to sleep.
+     * Arming before that last iteration's loads means a write can't be missed.
+     *
+     * @param pc     the address of the branch instruction
+     * @param target the branch target
+     * @param RB     the register bank
+     * @param DM     the data memory port
+     */
+    template <class REGS, class MEM>
+    void endIteration(ac_word pc, ac_word target, REGS &RB, MEM &DM) {
+      if (stored || readDevice || guestArmed || numLoads == 0 ||
+          numLoads > SPIN_MAX_LOADS) {
+        abandon(DM);
+        loopPC = 0;
+        startIteration();
+        return;
+      }
+
+      // Loops that load different values, such as ones walking an array,
+      // stop here without reading the register bank
+      if (pc != loopPC || !sameLoads()) {
+        abandon(DM);
+        loopPC = pc;
+        haveRegisters = false;
+        startIteration();
+        return;
+      }
+
+      bool same = haveRegisters;
+      for (int i = 0; i < 32; i++) {
+        ac_word value = RB[i];
+        same = same && registers[i] == value;
+        registers[i] = value;
+      }
+      haveRegisters = true;
+
+      if (!same) {
+        abandon(DM);
+      } else if (armed) {
+        sc_time start = sc_time_stamp();
+        DM.read(WFE_ADDRESS + WFE_INDEX_WAIT);
+        double slept = (sc_time_stamp() - start) / sc_time(1, SC_NS);
+        ++numSleeps;
+        sleepTime += slept;
+        // One instruction per ns, the delay slot included in the body
+        skippedInstructions += slept;
+        armed = false;
+      } else if (++matches >= SPIN_THRESHOLD) {
+        for (int i = 0; i < numLoads; i++) {
+          DM.write(WFE_ADDRESS + WFE_INDEX_MONITOR, loadAddresses[i]);
+        }
+        armed = true;
+      }
+
+      startIteration();
+    }
+
+    uint64_t getNumSleeps() {
+      return numSleeps;
+    }
+
+    double getSleepTime() {
+      return sleepTime;
+    }
+
+    double getSkippedInstructions() {
+      return skippedInstructions;
+    }
+};
+
+/**
+ * Ends an iteration of a candidate spin loop if the branch just taken is a
+ * short backward one.
+ *
+ * @param spin   the spin-loop detector of the processor
+ * @param pc     the address of the branch instruction
+ * @param target the branch target
+ * @param RB     the register bank
+ * @param DM     the data memory port
+ */
+template <class REGS, class MEM>
+inline void check_spin_loop(SpinDetector &spin, ac_word pc, ac_word target,
+                            REGS &RB, MEM &DM)
+{
+  if (target <= pc && pc - target <= 4 * SPIN_MAX_BODY) {
+    spin.endIteration(pc, target, RB, DM);
+  }
+}
+
+/**
+ * Spin-loop detector of the processor whose instruction is being executed,
+ * looked up once per instruction. Memory accesses may let another processor
+ * run, so behaviors that access memory copy it before doing so.
+ */
+static SpinDetector *current_spin;
+
 //!Generic instruction behavior method.
 void ac_behavior( instruction )
 {
@@ -61,6 +363,7 @@ void ac_behavior( instruction )
   ac_pc = npc;
   npc = ac_pc + 4;
 #endif
+  current_spin = &per_processor<SpinDetector>(this);
 };
 
 //! Instruction Format behavior methods.
@@ -86,15 +389,24 @@ void ac_behavior(begin)
 void ac_behavior(end)
 {
   dbg_printf("@@@ end behavior @@@\n");
+  SpinDetector& spin = per_processor<SpinDetector>(this);
+  if (spin.getNumSleeps() > 0) {
+    fprintf(stderr, "Spin loops: slept %llu times, %.0lf ns "
+            "(~%.0lf instructions skipped)\n",
+            (unsigned long long) spin.getNumSleeps(), spin.getSleepTime(),
+            spin.getSkippedInstructions());
+  }
 }
 
 
 //!Instruction lb behavior method.
 void ac_behavior( lb )
 {
+  SpinDetector &spin = *current_spin;
   char byte;
   dbg_printf("lb r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   byte = DM.read_byte(RB[rs]+ imm);
+  spin.noteLoad(RB[rs] + imm, byte);
   RB[rt] = (ac_Sword)byte ;
   dbg_printf("Result = %#x\n", RB[rt]);
 };
@@ -102,9 +414,11 @@ void ac_behavior( lb )
 //!Instruction lbu behavior method.
 void ac_behavior( lbu )
 {
+  SpinDetector &spin = *current_spin;
   unsigned char byte;
   dbg_printf("lbu r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   byte = DM.read_byte(RB[rs]+ imm);
+  spin.noteLoad(RB[rs] + imm, byte);
   RB[rt] = byte ;
   dbg_printf("Result = %#x\n", RB[rt]);
 };
@@ -112,9 +426,11 @@ void ac_behavior( lbu )
 //!Instruction lh behavior method.
 void ac_behavior( lh )
 {
+  SpinDetector &spin = *current_spin;
   short int half;
   dbg_printf("lh r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   half = DM.read_half(RB[rs]+ imm);
+  spin.noteLoad(RB[rs] + imm, half);
   RB[rt] = (ac_Sword)half ;
   dbg_printf("Result = %#x\n", RB[rt]);
 };
@@ -122,8 +438,10 @@ void ac_behavior( lh )
 //!Instruction lhu behavior method.
 void ac_behavior( lhu )
 {
+  SpinDetector &spin = *current_spin;
   unsigned short int  half;
   half = DM.read_half(RB[rs]+ imm);
+  spin.noteLoad(RB[rs] + imm, half);
   RB[rt] = half ;
   dbg_printf("Result = %#x\n", RB[rt]);
 };
@@ -131,14 +449,18 @@ void ac_behavior( lhu )
 //!Instruction lw behavior method.
 void ac_behavior( lw )
 {
+  SpinDetector &spin = *current_spin;
   dbg_printf("lw r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
-  RB[rt] = DM.read(RB[rs]+ imm);
+  ac_word addr = RB[rs] + imm;
+  RB[rt] = DM.read(addr);
+  spin.noteLoad(addr, RB[rt]);
   dbg_printf("Result = %#x\n", RB[rt]);
 };
 
 //!Instruction lwl behavior method.
 void ac_behavior( lwl )
 {
+  SpinDetector &spin = *current_spin;
   dbg_printf("lwl r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
   ac_Uword data;
@@ -146,6 +468,7 @@ void ac_behavior( lwl )
   addr = RB[rs] + imm;
   offset = (addr & 0x3) * 8;
   data = DM.read(addr & 0xFFFFFFFC);
+  spin.noteLoad(addr & 0xFFFFFFFC, data);
   data <<= offset;
   data |= RB[rt] & ((1<<offset)-1);
   RB[rt] = data;
@@ -155,6 +478,7 @@ void ac_behavior( lwl )
 //!Instruction lwr behavior method.
 void ac_behavior( lwr )
 {
+  SpinDetector &spin = *current_spin;
   dbg_printf("lwr r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
   ac_Uword data;
@@ -162,6 +486,7 @@ void ac_behavior( lwr )
   addr = RB[rs] + imm;
   offset = (3 - (addr & 0x3)) * 8;
   data = DM.read(addr & 0xFFFFFFFC);
+  spin.noteLoad(addr & 0xFFFFFFFC, data);
   data >>= offset;
   data |= RB[rt] & (0xFFFFFFFF << (32-offset));
   RB[rt] = data;
@@ -171,34 +496,41 @@ void ac_behavior( lwr )
 //!Instruction sb behavior method.
 void ac_behavior( sb )
 {
+  SpinDetector &spin = *current_spin;
   unsigned char byte;
   dbg_printf("sb r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   byte = RB[rt] & 0xFF;
   DM.write_byte(RB[rs] + imm, byte);
+  spin.noteStore(RB[rs] + imm);
   dbg_printf("Result = %#x\n", (int) byte);
 };
 
 //!Instruction sh behavior method.
 void ac_behavior( sh )
 {
+  SpinDetector &spin = *current_spin;
   unsigned short int half;
   dbg_printf("sh r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   half = RB[rt] & 0xFFFF;
   DM.write_half(RB[rs] + imm, half);
+  spin.noteStore(RB[rs] + imm);
   dbg_printf("Result = %#x\n", (int) half);
 };
 
 //!Instruction sw behavior method.
 void ac_behavior( sw )
 {
+  SpinDetector &spin = *current_spin;
   dbg_printf("sw r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   DM.write(RB[rs] + imm, RB[rt]);
+  spin.noteStore(RB[rs] + imm);
   dbg_printf("Result = %#x\n", RB[rt]);
 };
 
 //!Instruction swl behavior method.
 void ac_behavior( swl )
 {
+  SpinDetector &spin = *current_spin;
   dbg_printf("swl r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
   ac_Uword data;
@@ -209,12 +541,14 @@ void ac_behavior( swl )
   data >>= offset;
   data |= DM.read(addr & 0xFFFFFFFC) & (0xFFFFFFFF << (32-offset));
   DM.write(addr & 0xFFFFFFFC, data);
+  spin.noteStore(addr & 0xFFFFFFFC);
   dbg_printf("Result = %#x\n", data);
 };
 
 //!Instruction swr behavior method.
 void ac_behavior( swr )
 {
+  SpinDetector &spin = *current_spin;
   dbg_printf("swr r%d, %d(r%d)\n", rt, imm & 0xFFFF, rs);
   unsigned int addr, offset;
   ac_Uword data;
@@ -225,6 +559,7 @@ void ac_behavior( swr )
   data <<= offset;
   data |= DM.read(addr & 0xFFFFFFFC) & ((1<<offset)-1);
   DM.write(addr & 0xFFFFFFFC, data);
+  spin.noteStore(addr & 0xFFFFFFFC);
   dbg_printf("Result = %#x\n", data);
 };
 
@@ -566,6 +901,8 @@ void ac_behavior( j )
 #ifndef NO_NEED_PC_UPDATE
   npc =  (ac_pc & 0xF0000000) | addr;
 #endif
+  check_spin_loop(*current_spin, ac_pc - 4,
+                  (ac_pc & 0xF0000000) | addr, RB, DM);
   dbg_printf("Target = %#x\n", (ac_pc & 0xF0000000) | addr );
 };
 
@@ -625,6 +962,8 @@ void ac_behavior( beq )
 #ifndef NO_NEED_PC_UPDATE
     npc = ac_pc + (imm<<2);
 #endif
+    check_spin_loop(*current_spin, ac_pc - 4,
+                    ac_pc + (imm<<2), RB, DM);
     dbg_printf("Taken to %#x\n", ac_pc + (imm<<2));
   }
 };
@@ -637,6 +976,8 @@ void ac_behavior( bne )
 #ifndef NO_NEED_PC_UPDATE
     npc = ac_pc + (imm<<2);
 #endif
+    check_spin_loop(*current_spin, ac_pc - 4,
+                    ac_pc + (imm<<2), RB, DM);
     dbg_printf("Taken to %#x\n", ac_pc + (imm<<2));
   }
 };
@@ -649,6 +990,8 @@ void ac_behavior( blez )
 #ifndef NO_NEED_PC_UPDATE
     npc = ac_pc + (imm<<2), 1;
 #endif
+    check_spin_loop(*current_spin, ac_pc - 4,
+                    ac_pc + (imm<<2), RB, DM);
     dbg_printf("Taken to %#x\n", ac_pc + (imm<<2));
   }
 };
@@ -661,6 +1004,8 @@ void ac_behavior( bgtz )
 #ifndef NO_NEED_PC_UPDATE
     npc = ac_pc + (imm<<2);
 #endif
+    check_spin_loop(*current_spin, ac_pc - 4,
+                    ac_pc + (imm<<2), RB, DM);
     dbg_printf("Taken to %#x\n", ac_pc + (imm<<2));
   }
 };
@@ -673,6 +1018,8 @@ void ac_behavior( bltz )
 #ifndef NO_NEED_PC_UPDATE
     npc = ac_pc + (imm<<2);
 #endif
+    check_spin_loop(*current_spin, ac_pc - 4,
+                    ac_pc + (imm<<2), RB, DM);
     dbg_printf("Taken to %#x\n", ac_pc + (imm<<2));
   }
 };
@@ -685,6 +1032,8 @@ void ac_behavior( bgez )
 #ifndef NO_NEED_PC_UPDATE
     npc = ac_pc + (imm<<2);
 #endif
+    check_spin_loop(*current_spin, ac_pc - 4,
+                    ac_pc + (imm<<2), RB, DM);
     dbg_printf("Taken to %#x\n", ac_pc + (imm<<2));
   }
 };
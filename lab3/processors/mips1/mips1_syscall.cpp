@@ -59,7 +59,12 @@ void mips1_syscall::set_buffer(int argn, unsigned char* buf, unsigned int size)
 //  for (unsigned int i = 0; i<size; i++, addr++) {
 //    DM.write_byte(addr, buf[i]);
   for (unsigned int i = 0; i<size; i+=4, addr+=4) {
-    DM.write(addr, convert_endian(4, *(unsigned int *) &buf[i], false));
+    unsigned int word = *(unsigned int *) &buf[i];
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Target is big endian: one bswap instead of a per-byte conversion
+    word = __builtin_bswap32(word);
+#endif
+    DM.write(addr, word);
   }
 }
 
@@ -2,7 +2,7 @@
 #include <stdlib.h>
 
 #define FILTER_ADDRESS  0x700000
-#define FILTER_ADDRESS_OFFSET 44
+#define FILTER_ADDRESS_OFFSET 0x100
 #define FILTER_INDEX_TL 0x00
 #define FILTER_INDEX_TC 0x04
 #define FILTER_INDEX_TR 0x08
@@ -14,13 +14,34 @@
 #define FILTER_INDEX_BR 0x20
 #define FILTER_INDEX_TYPE 0x24
 #define FILTER_INDEX_RESULT 0x28
+#define FILTER_INDEX_SRC 0x2C
+#define FILTER_INDEX_DST 0x30
+#define FILTER_INDEX_WIDTH 0x34
+#define FILTER_INDEX_HEIGHT 0x38
+#define FILTER_INDEX_STRIDE 0x3C
+#define FILTER_INDEX_TILE 0x40
+#define FILTER_INDEX_KSIZE 0x44
+#define FILTER_INDEX_SHIFT 0x48
+#define FILTER_INDEX_BIAS 0x4C
+#define FILTER_INDEX_COEF 0x50
+#define FILTER_INDEX_PUSH 0xB4
+#define FILTER_INDEX_POP 0xB8
+#define FILTER_INDEX_QSTATUS 0xBC
+#define FILTER_INDEX_COL_T 0xC0
+#define FILTER_INDEX_COL_M 0xC4
+#define FILTER_INDEX_COL_B 0xC8
+#define FILTER_INDEX_START 0xCC
+#define FILTER_INDEX_STATUS 0xD0
+#define FILTER_INDEX_NOTIFY 0xD4
 
 #define FILTER_TYPE_MEAN  0
 #define FILTER_TYPE_SOBEL 1
+#define FILTER_TYPE_SOBEL_FAST 2
+#define FILTER_TYPE_CONVOLUTION 3
+#define FILTER_TYPE_MEDIAN 4
 
-#define TAKEN 0
-#define AVAILABLE 1
-#define NUM_FILTERS 4
+#define FILTER_STATUS_BUSY 1
+#define FILTER_STATUS_DONE 2
 
 #define NUM_PROC 8
 #define NUM_MALLOC_RETRIES 30
@@ -30,23 +51,54 @@ volatile int proc_order = 0;
 volatile int proc_counter = 0;
 
 volatile int arrived = 0, ready = 0;
-volatile int *lock_ptr = (volatile int *) 0x600000;
+volatile int *ticket_ptr = (volatile int *) 0x600004;
+volatile int *serving_ptr = (volatile int *) 0x600008;
+volatile int *wfe_monitor_ptr = (volatile int *) 0x660000;
+volatile int *wfe_wait_ptr = (volatile int *) 0x660004;
+volatile int *wfe_clear_ptr = (volatile int *) 0x66000C;
 
-volatile int filters[NUM_FILTERS] = {AVAILABLE, AVAILABLE, AVAILABLE, AVAILABLE};
+/**
+ * Arm the event monitor on an address. A following wait_for_event() returns as
+ * soon as any core writes to it, or right away if it was written in between.
+ */
+void monitor(volatile int *address) {
+  *wfe_monitor_ptr = (int) address;
+}
+
+/**
+ * Put this core to sleep until one of the monitored addresses is written.
+ */
+void wait_for_event() {
+  *wfe_wait_ptr;
+}
+
+/**
+ * Disarm the event monitor once the condition waited for holds, so that a
+ * write seen in the meantime doesn't cut the next wait_for_event() short.
+ */
+void clear_events() {
+  *wfe_clear_ptr = 0;
+}
 
 /**
- * Acquire the lock by reading the lock's address. The read will return 0 if the
- * lock was granted.
+ * Acquire the lock by taking a ticket and waiting until it is being served.
+ * Cores are granted the lock in the order they asked for it.
  */
 void acquire_lock() {
-  while (*lock_ptr);
+  int ticket = *ticket_ptr;
+  while (*serving_ptr != ticket) {
+    monitor(serving_ptr);
+    if (*serving_ptr != ticket) wait_for_event();
+  }
+  clear_events();
 }
 
 /**
- * Release the lock by writting the value 0 to the lock's address.
+ * Release the lock by writting to the "now serving" address, which passes the
+ * lock to the next ticket.
  */
 void release_lock() {
-  *lock_ptr = 0;
+  *serving_ptr = 0;
 }
 
 /**
@@ -59,53 +111,28 @@ void synch() {
   if (arrived == NUM_PROC) ready = 0;
   release_lock();
 
-  while (arrived < NUM_PROC);
+  while (arrived < NUM_PROC) {
+    monitor(&arrived);
+    if (arrived < NUM_PROC) wait_for_event();
+  }
+  clear_events();
 
   acquire_lock();
   ready++;
   if (ready == NUM_PROC) arrived = 0;
   release_lock();
 
-  while (ready < NUM_PROC);
-}
-
-/**
- * Acquire one of the available filters.
- *
- * @return the number of the granted filter
- */
-int acquire_filter() {
-  int i, filter_number = -1;
-
-  while (filter_number == -1) {
-    for (i = 0; filter_number == -1 && i < NUM_FILTERS; i++) {
-      acquire_lock();
-      if (filters[i] == AVAILABLE) {
-        filters[i] = TAKEN;
-        filter_number = i;
-      }
-      release_lock();
-    }
+  while (ready < NUM_PROC) {
+    monitor(&ready);
+    if (ready < NUM_PROC) wait_for_event();
   }
-
-  return filter_number;
-}
-
-/**
- * Release the filter.
- *
- * @param filter_number the filter to be released
- */
-void release_filter(int filter_number) {
-  acquire_lock();
-  filters[filter_number] = AVAILABLE;
-  release_lock();
+  clear_events();
 }
 
 /**
- * Apply the selected filter on a 3x3 window.
+ * Write a 3x3 window and the filter type to the filter registers.
  */
-int apply_filter(int type, int filter_number,
+void load_window(int type, int filter_number,
                  int tl, int tc, int tr,
                  int ml, int mc, int mr,
                  int bl, int bc, int br) {
@@ -141,11 +168,108 @@ int apply_filter(int type, int filter_number,
 
   filter_address = (int *)(base + FILTER_INDEX_TYPE);
   *filter_address = type;
+}
+
+/**
+ * Apply the selected filter on a 3x3 window.
+ */
+int apply_filter(int type, int filter_number,
+                 int tl, int tc, int tr,
+                 int ml, int mc, int mr,
+                 int bl, int bc, int br) {
+  int *filter_address;
+  int base = FILTER_ADDRESS + filter_number * FILTER_ADDRESS_OFFSET;
+
+  load_window(type, filter_number, tl, tc, tr, ml, mc, mr, bl, bc, br);
+
+  // Writing start computes the result, reading it waits until it is ready
+  filter_address = (int *)(base + FILTER_INDEX_START);
+  *filter_address = 1;
 
   filter_address = (int *)(base + FILTER_INDEX_RESULT);
   return *filter_address;
 }
 
+/**
+ * Take the result of the oldest window pushed to the filter, waiting for it
+ * to be computed.
+ */
+int pop_filter(int filter_number) {
+  int *filter_address;
+  int base = FILTER_ADDRESS + filter_number * FILTER_ADDRESS_OFFSET;
+
+  filter_address = (int *)(base + FILTER_INDEX_POP);
+  return *filter_address;
+}
+
+/**
+ * Filter one row by streaming its columns through the filter window. Each
+ * column is three writes, and every column from the third on shifts a full
+ * window into the filter queue. Output pixels 1 to columns-2 are written to
+ * out.
+ */
+void stream_filter_row(int type, int filter_number,
+                       int *t, int *m, int *b, int *out, int columns) {
+  int *filter_address;
+  int base = FILTER_ADDRESS + filter_number * FILTER_ADDRESS_OFFSET;
+  int j;
+
+  // Writing the type starts a new row
+  filter_address = (int *)(base + FILTER_INDEX_TYPE);
+  *filter_address = type;
+
+  for (j = 0; j < columns; j++) {
+    filter_address = (int *)(base + FILTER_INDEX_COL_T);
+    *filter_address = t[j];
+
+    filter_address = (int *)(base + FILTER_INDEX_COL_M);
+    *filter_address = m[j];
+
+    filter_address = (int *)(base + FILTER_INDEX_COL_B);
+    *filter_address = b[j];
+
+    // Keep one window in flight: column j pushed pixel j-1, collect j-2
+    if (j >= 3) out[j-2] = pop_filter(filter_number);
+  }
+  if (columns > 2) out[columns-2] = pop_filter(filter_number);
+}
+
+/**
+ * Apply the selected filter on a whole tile. The filter reads the rows x columns
+ * input matrix from memory itself and writes the (rows-2)x(columns-2) filtered
+ * pixels to the interior columns of output.
+ *
+ * @return the number of filtered pixels
+ */
+int apply_filter_tile(int type, int filter_number,
+                      int *input, int *output, int rows, int columns) {
+  int *filter_address;
+  int base = FILTER_ADDRESS + filter_number * FILTER_ADDRESS_OFFSET;
+
+  filter_address = (int *)(base + FILTER_INDEX_SRC);
+  *filter_address = (int) input;
+
+  filter_address = (int *)(base + FILTER_INDEX_DST);
+  *filter_address = (int) output;
+
+  filter_address = (int *)(base + FILTER_INDEX_WIDTH);
+  *filter_address = columns;
+
+  filter_address = (int *)(base + FILTER_INDEX_HEIGHT);
+  *filter_address = rows;
+
+  filter_address = (int *)(base + FILTER_INDEX_STRIDE);
+  *filter_address = columns * sizeof(int);
+
+  filter_address = (int *)(base + FILTER_INDEX_TYPE);
+  *filter_address = type;
+
+  // Writing the tile register starts the filter
+  filter_address = (int *)(base + FILTER_INDEX_TILE);
+  *filter_address = 1;
+  return *filter_address;
+}
+
 /**
  * Apply the mean filter on a 3x3 window.
  */
@@ -286,7 +410,7 @@ void read_input(char *file, int pn, int **input, int *r, int *R, int *C) {
 }
 
 int main(int argc, char *argv[]){
-  int pn, i, j, filter_number;
+  int pn, i, filter_number;
   int r, R, C, *input, *output;
 
   // Sanitize arguments
@@ -307,26 +431,27 @@ int main(int argc, char *argv[]){
   output = try_malloc(r * C);
   memset(output, 0, r * C * sizeof(int));
   release_lock();
+
+  // Each core has a filter context of its own, the filter shares its compute
+  // units among them
+  filter_number = pn;
+#ifdef FILTER_PIXEL_MODE
   for (i = 1; i <= r; i++) {
-    for (j = 1; j < C - 1; j++) {
-      filter_number = acquire_filter();
-      output[map(i-1, j, C)] = sobel_filter(
-        filter_number,
-        input[map(i-1, j-1, C)], input[map(i-1, j, C)], input[map(i-1, j+1, C)],
-        input[map(i  , j-1, C)], input[map(i  , j, C)], input[map(i  , j+1, C)],
-        input[map(i+1, j-1, C)], input[map(i+1, j, C)], input[map(i+1, j+1, C)]
-      );
-      release_filter(filter_number);
-    }
+    stream_filter_row(FILTER_TYPE_SOBEL, filter_number,
+                      &input[map(i-1, 0, C)], &input[map(i, 0, C)],
+                      &input[map(i+1, 0, C)], &output[map(i-1, 0, C)], C);
   }
+#else
+  // The filter fetches the r+2 input rows itself and fills the r output rows
+  apply_filter_tile(FILTER_TYPE_SOBEL, filter_number, input, output, r + 2, C);
+#endif
 
   // Wait to write output in the correct order
-  while (1) {
-    acquire_lock();
-    i = proc_order;
-    release_lock();
-    if (i == pn) break;
+  while (proc_order != pn) {
+    monitor(&proc_order);
+    if (proc_order != pn) wait_for_event();
   }
+  clear_events();
 
   // Write output and mark that core has finished
   write_output(argv[2], pn, output, r, R, C);
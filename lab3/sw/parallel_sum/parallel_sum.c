@@ -9,13 +9,44 @@ volatile unsigned int sum[NUM_PROC];
 
 volatile int arrived = 0, ready = 0;
 volatile int *lock_ptr = (volatile int *) 0x600000;
+volatile int *wfe_monitor_ptr = (volatile int *) 0x660000;
+volatile int *wfe_wait_ptr = (volatile int *) 0x660004;
+volatile int *wfe_clear_ptr = (volatile int *) 0x66000C;
+
+/**
+ * Arm the event monitor on an address. A following wait_for_event() returns as
+ * soon as any core writes to it, or right away if it was written in between.
+ */
+void monitor(volatile int *address) {
+  *wfe_monitor_ptr = (int) address;
+}
+
+/**
+ * Put this core to sleep until one of the monitored addresses is written.
+ */
+void wait_for_event() {
+  *wfe_wait_ptr;
+}
+
+/**
+ * Disarm the event monitor once the condition waited for holds, so that a
+ * write seen in the meantime doesn't cut the next wait_for_event() short.
+ */
+void clear_events() {
+  *wfe_clear_ptr = 0;
+}
 
 /**
  * Acquire the lock by reading the lock's address. The read will return 0 if the
- * lock was granted.
+ * lock was granted. While it is taken, sleep until someone writes to it.
  */
 void acquire_lock() {
-  while (*lock_ptr);
+  while (*lock_ptr) {
+    monitor(lock_ptr);
+    if (!*lock_ptr) break;
+    wait_for_event();
+  }
+  clear_events();
 }
 
 /**
@@ -35,14 +66,22 @@ void synch() {
   if (arrived == NUM_PROC) ready = 0;
   release_lock();
 
-  while (arrived < NUM_PROC);
+  while (arrived < NUM_PROC) {
+    monitor(&arrived);
+    if (arrived < NUM_PROC) wait_for_event();
+  }
+  clear_events();
 
   acquire_lock();
   ready++;
   if (ready == NUM_PROC) arrived = 0;
   release_lock();
 
-  while (ready < NUM_PROC);
+  while (ready < NUM_PROC) {
+    monitor(&ready);
+    if (ready < NUM_PROC) wait_for_event();
+  }
+  clear_events();
 }
 
 int main(int argc, char *argv[]){